@@ -0,0 +1,46 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define CAPTURE_MAGIC_NS  0xa1b23c4du // pcap with nanosecond timestamps
+#define CAPTURE_LINKTYPE  101         // LINKTYPE_RAW: packets start with the IPv4 header
+#define CAPTURE_SNAPLEN   65535
+#define CAPTURE_HDR_SIZE  28          // IPv4 + UDP headers
+#define CAPTURE_BUFFER    (1 << 20)
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// Datagrams written to a pcap file instead of a socket, with the IPv4/UDP
+// headers they would have had on the wire. Nothing in the file depends on
+// the host: timestamps come from the stream clock and the IP id is a plain
+// counter, so virtual-time runs produce identical captures.
+typedef struct {
+  FILE     *f;
+  uint32_t  src_ip;   // network byte order
+  uint32_t  dst_ip;
+  uint16_t  src_port; // host byte order
+  uint16_t  ip_id;
+  uint64_t  packets;
+  pthread_mutex_t lock;
+  uint8_t   active;
+} CAPTURE;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int  capture_open(CAPTURE *cap, const char *path, const char *src_ip, uint16_t src_port, const char *dst_ip);
+int  capture_write(CAPTURE *cap, uint16_t dst_port, const uint8_t *data, size_t len, int64_t stamp_ns);
+void capture_close(CAPTURE *cap);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef CONT_PAYLOAD_HPP
+#define CONT_PAYLOAD_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+
+#include "worker_pool.h"
+#include "sample_ring.h"
+#include "strain_field.h"
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define CONT_VALUE_BASE 183  // value at rest, in units of LASER_CHANNEL_MULT
+#define CONT_VALUE_MAX  399
+
+// work (cont_batch_work) below which a batch is generated by the stream
+// thread alone: waking the pool and joining it costs a few tens of us
+#define CONT_POOL_MIN_WORK 32768
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// samples pushed into the ring that still have to be generated
+typedef struct {
+  uint8_t  *slot[SAMPLE_RING_SLOTS];
+  uint64_t id[SAMPLE_RING_SLOTS];   // absolute sample number, seeds the values
+  size_t   count;
+  uint8_t  channels;
+  uint8_t  gratings;
+} CONT_BATCH;
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+extern uint64_t payload_seed;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+void create_cont_values(uint8_t *sample, size_t first, size_t count, uint64_t sample_id);
+void create_cont_sample(uint8_t *sample, size_t len, uint64_t sample_id);
+size_t cont_batch_work(const CONT_BATCH *batch);
+void generate_cont_batch(CONT_BATCH *batch, WORKER_POOL *pool);
+
+#endif
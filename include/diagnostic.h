@@ -0,0 +1,118 @@
+#ifndef DIAGNOSTIC_HPP
+#define DIAGNOSTIC_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define DIAG_PERIOD_MS           1000   // model step and periodic frame period
+
+// defaults of the model parameters (DIAG_PARAMS)
+#define DIAG_OPERATIONAL_AFTER   1      // diagnostic requests to leave stand-by, 0 same as 1
+#define DIAG_FAULT_PPM           200    // chance of a fault per operational step
+#define DIAG_TEMP_MAX_C          70.0   // over-temperature fault threshold
+#define DIAG_ERROR_HOLD_MS       5000   // time spent in error before recovery starts
+#define DIAG_RECOVERY_MS         3000   // time spent recovering before operational
+
+// health model
+#define DIAG_TEMP_AMBIENT_C      25.0
+#define DIAG_TEMP_LOAD_C         15.0   // steady-state heating when operational
+#define DIAG_TEMP_TAU_S          120.0  // thermal time constant
+#define DIAG_LASER_NOMINAL_UW    10000.0
+#define DIAG_LASER_AGING_PPM_H   50.0   // laser power loss per hour of operation
+#define DIAG_RX_ERROR_PPM        1000   // chance of a receive error per step
+
+// optional extension appended after the libsmartscan diagnostic frame (-E),
+// offsets from its end; the frame itself is left as the library builds it
+#define DIAG_EXT_TEMP            0      // int16, 0.01 C
+#define DIAG_EXT_LASER           2      // uint16, uW
+#define DIAG_EXT_ERRORS          4      // uint32, faults since start
+#define DIAG_EXT_RX_ERRORS       8      // uint32, receive errors since start
+#define DIAG_EXT_UPTIME          12     // uint32, seconds
+#define DIAG_EXT_MODEL_STATE     16     // uint8, DIAG_STATE_*
+#define DIAG_EXT_SIZE            17
+#define DIAG_FRAME_MAX           64
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+typedef enum {
+  DIAG_STATE_STANDBY = 0,
+  DIAG_STATE_OPERATIONAL,
+  DIAG_STATE_ERROR,
+  DIAG_STATE_RECOVERY
+} DIAG_STATE;
+
+typedef enum {
+  DIAG_P_OPERATIONAL_AFTER = 0,
+  DIAG_P_FAULT_PPM,
+  DIAG_P_TEMP_MAX,
+  DIAG_P_ERROR_HOLD,
+  DIAG_P_RECOVERY,
+  DIAG_P_AGING,
+  DIAG_P_RX_ERROR_PPM,
+  DIAG_PARAM_NR
+} DIAG_PARAM;
+
+// parameters of the model, DIAG_* defaults set by diag_init, changed at run
+// time by name with diag_set (-P name=value or a scenario step)
+typedef struct {
+  uint32_t  operational_after; // diagnostic requests to leave stand-by, 0 same as 1
+  uint32_t  fault_ppm;         // chance of a fault per operational step
+  double    temp_max_c;        // over-temperature fault threshold
+  uint32_t  error_hold_ms;     // time spent in error before recovery starts
+  uint32_t  recovery_ms;       // time spent recovering before operational
+  double    aging_ppm_h;       // laser power loss per hour of operation
+  uint32_t  rx_error_ppm;      // chance of a receive error per step
+} DIAG_PARAMS;
+
+// Board health model and its encoded diagnostic frame.
+// The frame is cached and encoded again only when one of the reported
+// (quantized) values or the state changes, so answering a poll is a copy.
+typedef struct {
+  pthread_mutex_t lock;
+  DIAG_PARAMS param;
+
+  uint8_t   *ssi_state;      // wire state, also written by maintenance messages
+  uint8_t   last_ssi_state;
+  DIAG_STATE state;
+  int64_t   state_ms;        // time spent in the current state
+  uint32_t  requests;
+  uint8_t   started;         // has been operational, stand-by is no longer left alone
+
+  double    temp_c;
+  double    laser_uw;
+  double    uptime_s;
+  uint32_t  errors;
+  uint32_t  rx_errors;
+  uint64_t  rng;
+
+  int16_t   q_temp;          // values as encoded in the cached frame
+  uint16_t  q_laser;
+  uint32_t  q_uptime;
+  uint8_t   dirty;
+
+  uint8_t   frame[DIAG_FRAME_MAX];
+  size_t    base_len;        // libsmartscan frame
+  size_t    frame_len;       // plus the extension when enabled
+  uint64_t  encodings;
+} DIAG_MODEL;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+void   diag_init(DIAG_MODEL *diag, uint8_t *ssi_state, uint64_t seed, size_t frame_len, int extended);
+int    diag_check(const char *name, double value);
+int    diag_set(DIAG_MODEL *diag, const char *name, double value);
+void   diag_on_request(DIAG_MODEL *diag);
+void   diag_step(DIAG_MODEL *diag, int64_t dt_ms);
+size_t diag_frame(DIAG_MODEL *diag, uint8_t *message, size_t len);
+const char *diag_state_name(DIAG_STATE state);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef FOOTPRINT_HPP
+#define FOOTPRINT_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stddef.h>
+#include <pthread.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+// EMU_EMBEDDED is set by the embedded CMake profile: smaller pools, fixed
+// thread stacks and a single malloc arena
+#ifndef EMU_EMBEDDED
+#define EMU_EMBEDDED 0
+#endif
+
+#if EMU_EMBEDDED
+#define FOOTPRINT_THREAD_STACK (64 * 1024)
+#else
+#define FOOTPRINT_THREAD_STACK 0 // libc default (RLIMIT_STACK, usually 8 MB)
+#endif
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+void footprint_init();
+int  footprint_thread_create(pthread_t *tid, void *(*fn)(void *), void *arg);
+void footprint_report(const char *when);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef RAW_TX_HPP
+#define RAW_TX_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_packet.h>
+
+#include "footprint.h"
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define RAW_TX_FRAME_SIZE 2048
+#if EMU_EMBEDDED
+#define RAW_TX_FRAME_NR   64
+#else
+#define RAW_TX_FRAME_NR   256
+#endif
+#define RAW_TX_BLOCK_SIZE 4096
+#define RAW_TX_MAX_DEST   4
+
+#define RAW_TX_HDR_SIZE (sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// Ethernet/IP/UDP headers of one destination, built once; only tot_len, id
+// and the UDP length change per packet, so the IP checksum is completed
+// from a precomputed partial sum
+typedef struct {
+  uint8_t  header[RAW_TX_HDR_SIZE];
+  uint32_t ip_partial_sum;
+} RAW_TX_DEST;
+
+// PACKET_TX_RING transmit path: frames are built in place in the mmap'ed
+// ring and handed to the kernel with a single send() per batch
+typedef struct {
+  int       fd;
+  uint8_t  *ring;
+  size_t    ring_size;
+  unsigned  frame_nr;
+  unsigned  current;        // next frame to fill
+  unsigned  queued;         // frames committed since the last kick
+  uint16_t  ip_id;
+  int       ifindex;
+  uint8_t   src_mac[ETH_ALEN];
+  uint8_t   dst_mac[ETH_ALEN];
+  uint8_t   dst_mac_set;    // explicit MAC, otherwise the neighbour table
+  struct in_addr src_ip;
+  uint16_t  src_port;
+  RAW_TX_DEST dest[RAW_TX_MAX_DEST];
+  int       dest_nr;
+  uint8_t   active;
+} RAW_TX;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int      raw_tx_open(RAW_TX *tx, const char *ifname, const char *src_ip, uint16_t src_port, const char *dst_mac);
+int      raw_tx_add_dest(RAW_TX *tx, const char *dst_ip, uint16_t dst_port);
+uint8_t *raw_tx_frame(RAW_TX *tx, size_t *capacity);
+void     raw_tx_commit(RAW_TX *tx, int dest, size_t len);
+int      raw_tx_kick(RAW_TX *tx);
+void     raw_tx_close(RAW_TX *tx);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SAMPLE_RING_HPP
+#define SAMPLE_RING_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+// two full datagrams of payload, so one can fill while the other is flushed
+#define SAMPLE_RING_BYTES   (2 * 1500)
+#define SAMPLE_RING_SLOTS   (SAMPLE_RING_BYTES / sizeof(uint16_t))
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// Ring of encoded continuous samples (one peak set per scan).
+// Samples are pushed at the scan rate and popped in datagram-sized batches,
+// so the number of samples carried on the wire no longer depends on how
+// often a datagram is sent.
+typedef struct {
+  uint8_t  data[SAMPLE_RING_BYTES];
+  struct timespec stamp[SAMPLE_RING_SLOTS]; // board timestamp of each sample
+  int64_t  deadline_ns[SAMPLE_RING_SLOTS];  // scheduled CLOCK_MONOTONIC instant
+  size_t   sample_size;                     // bytes of one encoded sample
+  size_t   capacity;                        // samples held by the ring
+  uint64_t head;                            // next sample to be written
+  uint64_t tail;                            // next sample to be sent
+  uint8_t  channels;
+  uint8_t  gratings;
+} SAMPLE_RING;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int      sample_ring_reset(SAMPLE_RING *ring, uint8_t channels, uint8_t gratings);
+size_t   sample_ring_count(const SAMPLE_RING *ring);
+uint8_t *sample_ring_push(SAMPLE_RING *ring, const struct timespec *stamp, int64_t deadline_ns);
+uint8_t *sample_ring_peek(SAMPLE_RING *ring, size_t offset);
+const struct timespec *sample_ring_stamp(const SAMPLE_RING *ring, size_t offset);
+int64_t  sample_ring_deadline(const SAMPLE_RING *ring, size_t offset);
+void     sample_ring_pop(SAMPLE_RING *ring, size_t count);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef SCENARIO_HPP
+#define SCENARIO_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define SCENARIO_MAX_STEPS 4096
+#define SCENARIO_LINE_SIZE 256
+#define SCENARIO_RAMP_STEPS  256 // most steps a ramp is expanded to
+#define SCENARIO_RAMP_MIN_MS 1   // shortest interval between two ramp steps
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+typedef enum {
+  SCN_CONT_RATE = 0, // ssi_cont_speed
+  SCN_SCAN_RATE,     // ssi_raw_speed (Hz)
+  SCN_SCAN_TIME,     // ssi_scan_speed (us)
+  SCN_CHANFORMAT,    // channels << 8 | gratings
+  SCN_STATE,         // ssi_state
+  SCN_DEMO,          // ssi_demo
+  SCN_OPERATIONAL_AFTER, // health model parameters (DIAG_PARAMS)
+  SCN_FAULT_PPM,
+  SCN_TEMP_MAX,
+  SCN_ERROR_HOLD,
+  SCN_RECOVERY,
+  SCN_AGING,
+  SCN_RX_ERROR_PPM,
+  SCN_STOP,          // end of the run
+  SCN_PARAMS
+} SCN_PARAM;
+
+typedef struct {
+  int64_t  at_ns;    // offset from the start of the scenario
+  uint32_t seq;      // file order, kept for simultaneous steps
+  uint8_t  param;
+  int32_t  value;
+} SCENARIO_STEP;
+
+// Timeline of configuration changes, sorted by instant.
+// Ramps and bursts are expanded into single steps when the file is loaded,
+// so running the scenario only waits for absolute deadlines.
+typedef struct {
+  SCENARIO_STEP step[SCENARIO_MAX_STEPS];
+  size_t count;
+  size_t next;
+} SCENARIO;
+
+typedef void (*SCENARIO_APPLY_FN)(uint8_t param, int32_t value);
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int  scenario_load(SCENARIO *scn, const char *path);
+int  scenario_has_stop(const SCENARIO *scn);
+void scenario_run(SCENARIO *scn, SCENARIO_APPLY_FN apply, volatile sig_atomic_t *stop);
+const char *scenario_param_name(uint8_t param);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+
+#include "footprint.h"
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define SHM_RING_MAGIC     0x5353524eu // "SSRN"
+#define SHM_RING_VERSION   1
+#define SHM_RING_SLOT_SIZE 2048        // slot header + one datagram
+#if EMU_EMBEDDED
+#define SHM_RING_SLOT_NR   256         // power of two
+#else
+#define SHM_RING_SLOT_NR   1024        // power of two
+#endif
+#define SHM_RING_HDR_SIZE  256
+#define SHM_RING_NAME_LEN  64
+
+#define SHM_RING_NAME      "/smartscanemu" // segments are <name>.cont and <name>.scan
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// Segment layout, all fields in host byte order:
+//
+//   offset 0    SHM_RING_HDR, SHM_RING_HDR_SIZE bytes
+//   offset 256  slot_nr slots of slot_size bytes each
+//
+// Slot i holds frame number n when n % slot_nr == i: a SHM_RING_SLOT header
+// followed by the datagram exactly as it would be sent on the UDP port.
+// head is written only by the producer and counts committed frames, tail is
+// written only by the consumer and counts released frames; both increase
+// forever and the ring is empty when they are equal, full when they differ
+// by slot_nr. A frame is readable once head has been loaded with acquire
+// semantics past it. The producer never blocks: when the ring is full the
+// frame is dropped and counted in dropped.
+//
+// seq is a futex word incremented after each batch of commits; a consumer
+// that finds the ring empty sets waiters, re-checks head and waits on seq.
+// state is 1 while the producer runs and 0 once it has closed the segment.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_size;
+  uint32_t slot_nr;
+  uint32_t stream;     // UDP port the stream replaces (PORT_RX_CONT/SCAN)
+  uint32_t state;
+  uint64_t dropped;
+  uint64_t head    __attribute__((aligned(64)));
+  uint64_t tail    __attribute__((aligned(64)));
+  uint32_t seq     __attribute__((aligned(64)));
+  uint32_t waiters;
+} SHM_RING_HDR;
+
+typedef struct {
+  uint32_t len;        // datagram length
+  uint32_t reserved;
+  int64_t  stamp_ns;   // CLOCK_MONOTONIC at commit
+} SHM_RING_SLOT;
+
+// one end of a ring: the producer creates the segment, a consumer attaches
+typedef struct {
+  SHM_RING_HDR *hdr;
+  uint8_t  *slots;
+  size_t    size;
+  uint64_t  head;      // producer: next frame to fill; consumer: cached head
+  uint64_t  tail;      // consumer: next frame to read; producer: cached tail
+  uint8_t   pending;   // producer: commits not yet signalled
+  uint8_t   owner;
+  uint8_t   active;
+  char      name[SHM_RING_NAME_LEN];
+} SHM_RING;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int      shm_ring_create(SHM_RING *ring, const char *name, uint32_t stream);
+int      shm_ring_attach(SHM_RING *ring, const char *name);
+uint8_t *shm_ring_frame(SHM_RING *ring, size_t *capacity);
+void     shm_ring_commit(SHM_RING *ring, size_t len);
+void     shm_ring_drop(SHM_RING *ring);
+void     shm_ring_kick(SHM_RING *ring);
+const uint8_t *shm_ring_peek(SHM_RING *ring, size_t *len, int64_t *stamp_ns);
+void     shm_ring_release(SHM_RING *ring);
+int      shm_ring_wait(SHM_RING *ring, int timeout_ms);
+void     shm_ring_close(SHM_RING *ring);
+
+#endif
@@ -13,10 +13,26 @@
 #include <time.h>
 #include <semaphore.h>
 #include <pthread.h>
+#include <poll.h>
 
 #include <libutils/utils.h>
 #include <libsmartscan/smartscan_utils.h>
 
+#include "footprint.h"
+#include "trace.h"
+#include "stream_clock.h"
+#include "sample_ring.h"
+#include "worker_pool.h"
+#include "cont_payload.h"
+#include "strain_field.h"
+#include "raw_tx.h"
+#include "shm_ring.h"
+#include "tcp_stream.h"
+#include "uring.h"
+#include "capture.h"
+#include "diagnostic.h"
+#include "scenario.h"
+
 /*******************************************************************************
 * constants
 *******************************************************************************/
@@ -28,6 +44,35 @@
 
 #define SCAN_TIME_US 400
 
+#define RX_TIMEOUT_MS 20000 // wait for diagnostic or maintenance messages
+
+// the kernel ring backends hand the frames of a stream to the kernel at most
+// once per batch; the frames keep the stamp of their scheduled instant
+#define TX_BATCH_US     1000
+#define TX_FULL_WAIT_MS 10    // wait of a full TX ring for the kernel before the frame is dropped
+
+// virtual clock ids, also the order of the threads at equal instants
+#define VCLOCK_SCENARIO 0
+#define VCLOCK_DIAG     1
+#define VCLOCK_SCAN     2
+#define VCLOCK_CONT     3
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// transmit path of a data stream: the shared memory ring, the TCP server,
+// the raw TX ring or the io_uring when enabled, the shared UDP socket otherwise
+typedef struct {
+  RAW_TX   raw;
+  int      raw_dest;
+  SHM_RING shm;
+  TCP_STREAM *tcp;      // shared by both streams
+  int      tcp_frame;   // pool frame being built
+  URING    *uring;      // shared by both streams
+  int      uring_frame; // pool frame being built
+  uint16_t port;        // UDP port of the stream, tags its TCP frames
+} STREAM_TX;
+
 /*******************************************************************************
 * const messages
 *******************************************************************************/
@@ -0,0 +1,94 @@
+#ifndef SMARTSCANEMU_CHECK_HPP
+#define SMARTSCANEMU_CHECK_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // recvmmsg
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libutils/utils.h>
+#include <libsmartscan/smartscan_utils.h>
+
+#include "stream_clock.h"
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define CHECK_LISTEN_IP_ADD "0.0.0.0"
+
+#define CHECK_BATCH      64          // datagrams per recvmmsg call
+#define CHECK_PIPE_SIZE  (1 << 16)   // records between receiver and stats thread
+#define CHECK_HIST_BINS  24          // log2 buckets in microseconds
+#define CHECK_HDR_SIZE   HD_CONT_DATA_SIZE // continuous and scan header, ucHdrSizex4 * 4
+
+#define CHECK_STREAM_CONT 0
+#define CHECK_STREAM_SCAN 1
+#define CHECK_STREAM_DIAG 2
+#define CHECK_STREAM_MAIN 3
+#define CHECK_STREAMS     4
+
+// consistency flags of a record
+#define CHECK_ERR_SHORT   0x01 // shorter than the header
+#define CHECK_ERR_SIZE    0x02 // usFrameSize does not match the datagram
+#define CHECK_ERR_HDR     0x04 // ucHdrSizex4 * 4 is not CHECK_HDR_SIZE
+#define CHECK_ERR_PAYLOAD 0x08 // payload is not a whole number of frames
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// one received datagram, decoded by the receiver thread
+typedef struct {
+  uint8_t  stream;
+  uint8_t  errors;
+  uint16_t len;
+  uint16_t samples;     // continuous frames or scan steps carried
+  uint16_t interval_us; // usTimeInterval
+  uint32_t counter;     // ulFrameCount
+  int64_t  stamp_ns;    // ulTimeStampH/L
+  int64_t  arrival_ns;  // kernel receive timestamp (CLOCK_REALTIME)
+} CHECK_RECORD;
+
+// single producer/single consumer ring between the two threads
+typedef struct {
+  CHECK_RECORD rec[CHECK_PIPE_SIZE];
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t tail __attribute__((aligned(64)));
+  uint64_t dropped;
+} CHECK_PIPE;
+
+typedef struct {
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t samples;
+  uint64_t gaps;        // missing ulFrameCount values
+  uint64_t reordered;   // counter went backwards
+  uint64_t errors;      // packets with a consistency flag
+  uint8_t  have_last;
+  uint8_t  have_counter;
+  uint32_t last_counter;  // highest in-order counter of a full frame
+  int64_t  last_arrival_ns;
+  int64_t  first_arrival_ns;
+  uint64_t lat_samples;   // full frames, the packets with a latency
+  double   lat_sum_us;
+  int64_t  lat_min_us;
+  int64_t  lat_max_us;
+  uint64_t iat_hist[CHECK_HIST_BINS]; // inter-arrival times
+  uint64_t lat_hist[CHECK_HIST_BINS]; // one-way latencies
+} CHECK_STATS;
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef STRAIN_FIELD_HPP
+#define STRAIN_FIELD_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define FIELD_MAX_CHANNELS  16
+#define FIELD_MAX_GRATINGS  32
+#define FIELD_MAX_SENSORS   512
+#define FIELD_LINE_SIZE     256
+#define FIELD_LANES         8           // floats per matvec block, factor rows are padded to it
+
+#define FIELD_CACHE_MAGIC   0x53534643u // "SSFC"
+#define FIELD_CACHE_VERSION 1
+#define FIELD_CACHE_SUFFIX  ".chol"
+
+// defaults of the layout parameters, in units of the continuous values
+#define FIELD_STRAIN_SIGMA  12.0
+#define FIELD_STRAIN_LENGTH 0.5         // m
+#define FIELD_TEMP_SIGMA    6.0
+#define FIELD_TEMP_LENGTH   3.0         // m
+#define FIELD_NOISE_SIGMA   1.0
+#define FIELD_KNOT_SAMPLES  100
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+typedef struct {
+  uint8_t channel;
+  uint8_t grating;
+  double  x, y, z;     // m
+} FIELD_SENSOR;
+
+// Spatially correlated field over the gratings of a sensor layout.
+// The covariance of two gratings at distance d is
+//   strain_sigma^2 exp(-d^2 / 2 strain_length^2) + temp_sigma^2 exp(-d^2 / 2 temp_length^2)
+// plus noise_sigma^2 on the diagonal, and the field of a sample is factor * z,
+// where factor is the lower Cholesky factor of the covariance and z is a vector
+// of unit normals. z is drawn at every knot_samples samples and interpolated
+// in between, so the field also evolves smoothly in time. Every value depends
+// only on the seed and the sample number, like the uncorrelated payload.
+typedef struct {
+  FIELD_SENSOR sensor[FIELD_MAX_SENSORS]; // sorted by channel and grating
+  size_t   n;
+  float   *factor;                        // row i at offset[i], padded to FIELD_LANES with zeros
+  uint32_t offset[FIELD_MAX_SENSORS];
+  int16_t  row[FIELD_MAX_CHANNELS][FIELD_MAX_GRATINGS]; // sensor of each grating, -1 when not in the layout
+  double   strain_sigma, strain_length;
+  double   temp_sigma, temp_length;
+  double   noise_sigma;
+  uint32_t knot_samples;
+  uint8_t  active;
+} STRAIN_FIELD;
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+extern STRAIN_FIELD strain_field;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int  strain_field_load(STRAIN_FIELD *field, const char *path);
+void strain_field_values(STRAIN_FIELD *field, uint8_t *values, uint8_t channel, uint8_t gratings, uint64_t sample_id);
+void strain_field_free(STRAIN_FIELD *field);
+
+#endif
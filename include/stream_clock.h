@@ -0,0 +1,88 @@
+#ifndef STREAM_CLOCK_HPP
+#define STREAM_CLOCK_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define NSEC_PER_SEC  1000000000LL
+#define NSEC_PER_USEC 1000LL
+
+// a stream more than this late is re-anchored instead of bursting to catch up
+#define STREAM_CLOCK_MAX_LAG_NS (1000LL * 1000000LL)
+
+#define VIRTUAL_CLOCK_MAX 8 // threads paced by the virtual clock
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// Pacing and timestamp source of one data stream.
+// Sample n is scheduled at mono_epoch + n*period on CLOCK_MONOTONIC and is
+// stamped with real_epoch + (n*period)*(1 + drift) + offset, so the stamp in
+// the frame is the instant the board would have sampled it, not the instant
+// the emulator happened to build the datagram.
+typedef struct {
+  int64_t  mono_epoch_ns; // CLOCK_MONOTONIC instant of sample 0
+  int64_t  real_epoch_ns; // CLOCK_REALTIME instant of sample 0
+  uint64_t index;         // next sample to be emitted
+  uint32_t period_us;     // effective period between two samples
+  int64_t  now_ns;        // cached CLOCK_MONOTONIC, refreshed once per batch
+  uint8_t  running;
+} STREAM_CLOCK;
+
+// Simulated time shared by the pacing threads. Each thread registers with
+// a fixed id and only one runs at a time: a thread that waits hands over to
+// the waiting thread with the earliest deadline (lowest id on ties) and
+// time jumps to that deadline, so the interleaving and every timestamp
+// depend only on the configuration, not on the speed of the host.
+typedef struct {
+  uint8_t  enabled;
+  int64_t  now_ns;          // simulated CLOCK_MONOTONIC
+  int64_t  real_epoch_ns;   // simulated CLOCK_REALTIME at now_ns == 0
+  int      expected;        // threads to attach before time starts
+  int      attached;
+  int      running;         // id holding the clock, -1 when none
+  int64_t  deadline_ns[VIRTUAL_CLOCK_MAX];
+  uint8_t  state[VIRTUAL_CLOCK_MAX];
+  uint8_t  idle[VIRTUAL_CLOCK_MAX]; // waiting for a configuration change
+  pthread_mutex_t lock;
+  pthread_cond_t  cv;
+} VIRTUAL_CLOCK;
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+extern int64_t ts_offset_ns; // constant board clock offset
+extern double  ts_drift_ppm; // board oscillator drift
+
+extern VIRTUAL_CLOCK virtual_clock;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int64_t timespec_to_ns(const struct timespec *ts);
+void    ns_to_timespec(int64_t ns, struct timespec *ts);
+
+void    stream_clock_start(STREAM_CLOCK *clk, uint32_t period_us);
+void    stream_clock_stop(STREAM_CLOCK *clk);
+void    stream_clock_set_period(STREAM_CLOCK *clk, uint32_t period_us);
+int64_t stream_clock_refresh(STREAM_CLOCK *clk);
+int64_t stream_clock_deadline(STREAM_CLOCK *clk, uint64_t index);
+void    stream_clock_stamp(STREAM_CLOCK *clk, uint64_t index, struct timespec *stamp);
+void    stream_clock_wait_until(STREAM_CLOCK *clk, int64_t deadline_ns);
+void    stream_clock_wait(STREAM_CLOCK *clk);
+int64_t stream_clock_real_ns();
+
+void    virtual_clock_enable(int64_t real_epoch_ns, int threads);
+void    virtual_clock_attach(int id);
+void    virtual_clock_detach();
+void    virtual_clock_wait(int64_t deadline_ns, int idle);
+void    virtual_clock_interrupt();
+
+#endif
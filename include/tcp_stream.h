@@ -0,0 +1,100 @@
+#ifndef TCP_STREAM_HPP
+#define TCP_STREAM_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "footprint.h"
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define TCP_STREAM_PORT     30010
+#define TCP_PREFIX_SIZE     4     // BE uint16 datagram length, BE uint16 stream port
+#define TCP_FRAME_SIZE      2048  // prefix + one datagram
+#if EMU_EMBEDDED
+#define TCP_POOL_FRAMES     256
+#define TCP_CLIENT_QUEUE    64    // frames waiting per client, power of two
+#else
+#define TCP_POOL_FRAMES     2048
+#define TCP_CLIENT_QUEUE    256
+#endif
+#define TCP_MAX_CLIENTS     8
+#define TCP_IOV             32    // frames per sendmsg
+#define TCP_ZC_MAX          1024  // zerocopy sends awaiting completion per client, power of two
+
+// what happens to a client whose queue is full
+#define TCP_POLICY_DROP_OLDEST 0
+#define TCP_POLICY_DISCONNECT  1
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// a frame handed to the kernel with MSG_ZEROCOPY, kept until the
+// completion of its send call is read from the error queue
+typedef struct {
+  uint32_t seq;
+  uint16_t frame;
+} TCP_ZC_ENTRY;
+
+typedef struct {
+  int      fd;
+  uint8_t  active;
+  uint8_t  closing;     // queue overflow under TCP_POLICY_DISCONNECT
+  uint8_t  zerocopy;
+  struct sockaddr_in addr;
+  // frames not yet started, filled by the producers (lock)
+  uint16_t queue[TCP_CLIENT_QUEUE];
+  unsigned head, tail;
+  // frames claimed by the server thread, the first one sent up to send_off
+  uint16_t send[TCP_IOV];
+  unsigned send_nr;
+  size_t   send_off;
+  // zerocopy sends in flight
+  TCP_ZC_ENTRY zc[TCP_ZC_MAX];
+  unsigned zc_head, zc_tail;
+  uint32_t zc_seq;
+  uint64_t sent;
+  uint64_t dropped;
+  uint64_t copied;      // zerocopy sends the kernel completed with a copy
+} TCP_CLIENT;
+
+// Frames are built in place in a shared pool: each one starts with the
+// length prefix and is queued by reference to every connected client, so
+// the producers never wait on a socket. A dedicated thread accepts the
+// clients and drains their queues with one sendmsg per batch of frames.
+typedef struct {
+  uint8_t  frame[TCP_POOL_FRAMES][TCP_FRAME_SIZE];
+  uint16_t ref[TCP_POOL_FRAMES];
+  uint16_t free_list[TCP_POOL_FRAMES];
+  unsigned free_nr;
+  TCP_CLIENT client[TCP_MAX_CLIENTS];
+  int      client_nr;
+  int      listen_fd;
+  int      event_fd;
+  int      pending;     // commits since the last kick
+  int      zerocopy;
+  int      policy;
+  uint64_t dropped;     // frames no client could take
+  volatile int stop;
+  pthread_t thread;
+  pthread_mutex_t lock; // pool and client queues
+  uint8_t  active;
+} TCP_STREAM;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int      tcp_stream_open(TCP_STREAM *srv, uint16_t port, int zerocopy, int policy);
+uint8_t *tcp_stream_frame(TCP_STREAM *srv, int *frame, size_t *capacity);
+void     tcp_stream_commit(TCP_STREAM *srv, int frame, uint16_t stream, size_t len);
+void     tcp_stream_drop(TCP_STREAM *srv);
+void     tcp_stream_kick(TCP_STREAM *srv);
+void     tcp_stream_close(TCP_STREAM *srv);
+
+#endif
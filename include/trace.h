@@ -0,0 +1,45 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+// EMU_TRACE is set by CMake when <sys/sdt.h> (systemtap-sdt-dev) is found:
+// every tracepoint is then a single nop in the code plus an ELF note that
+// perf and bpftrace turn into a probe when attached. Without it the
+// tracepoints compile to nothing.
+#ifndef EMU_TRACE
+#define EMU_TRACE 0
+#endif
+
+#if EMU_TRACE
+#include <sys/sdt.h>
+#endif
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+// USDT probes of provider "smartscanemu", all with the same arguments:
+//   arg0 frame count (ulFrameCount of the datagram, 0 when it has none)
+//   arg1 stream id (UDP port the message goes to or comes from)
+//   arg2 length in bytes (the sendto result on send_return)
+//
+//   gen_start, gen_end         generate_cont_batch, the continuous values
+//                              of the samples due (arg2 samples, not bytes)
+//   build_start, build_end     create_cont / create_scan, packing the
+//                              headers and the generated values
+//   lock_wait, lock_acquired,  lock_m around the shared socket
+//   lock_release
+//   send_entry, send_return    sendto on the shared socket, not fired by
+//                              the -z, -t, -x, -u backends nor with -c
+//   parse_start, parse_end     parse_maintenance
+//   config_apply               a new configuration reaches the streams
+//                              (frame count of the continuous stream, stream 0)
+#if EMU_TRACE
+#define TRACE(probe, frame, stream, len) \
+  DTRACE_PROBE3(smartscanemu, probe, (uint32_t) (frame), (uint16_t) (stream), (int64_t) (len))
+#else
+#define TRACE(probe, frame, stream, len) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#include "footprint.h"
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define URING_ENTRIES     256   // submission queue entries, at least URING_FRAMES
+#if EMU_EMBEDDED
+#define URING_FRAMES      64
+#else
+#define URING_FRAMES      256
+#endif
+#define URING_FRAME_SIZE  2048  // one datagram
+#define URING_SQ_IDLE_MS  100   // the SQPOLL thread sleeps after this long without submissions
+
+// operation of a request, in the top bits of its user_data
+#define URING_OP_SEND     1
+#define URING_OP_RECV     2
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// a receive completed on one of the sockets, waiting for uring_wait_recv
+typedef struct {
+  int      fd;
+  int      res;
+  uint16_t frame;
+} URING_RECV;
+
+// Socket I/O through an io_uring, without liburing: the rings are mapped
+// from the kernel and driven with the raw system calls. Datagrams are built
+// in place in a pool of frames; a send or receive takes a frame from the
+// pool and its completion gives it back. Sends are IORING_OP_SENDMSG, the
+// only send taking a destination before 6.0 kernels. With zerocopy the pool is
+// registered with the kernel and sends use IORING_OP_SEND_ZC on the fixed
+// buffers, the frame coming back on the notification that the kernel no
+// longer reads it. With SQPOLL a kernel thread consumes the submissions and
+// uring_kick only enters the kernel to wake it up.
+typedef struct {
+  int      fd;
+  // submission queue
+  void    *sq_ptr;
+  size_t   sq_size;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t   sqes_size;
+  unsigned sq_entries;
+  // completion queue
+  void    *cq_ptr;
+  size_t   cq_size;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned to_submit;   // queued since the last io_uring_enter
+  // frame pool
+  uint8_t (*frame)[URING_FRAME_SIZE];
+  uint16_t free_list[URING_FRAMES];
+  unsigned free_nr;
+  struct sockaddr_in addr[URING_FRAMES];  // destination or source of each frame
+  struct msghdr msg[URING_FRAMES];
+  struct iovec iov[URING_FRAMES];
+  // completed receives
+  URING_RECV recv[URING_FRAMES];
+  unsigned recv_head, recv_tail;
+  int      sqpoll;
+  int      zerocopy;
+  int      ext_arg;     // timed waits, IORING_FEAT_EXT_ARG (5.11)
+  int      send_error;  // first failed send since the last kick, -errno
+  uint64_t enters;      // io_uring_enter calls
+  uint64_t sent;
+  uint64_t errors;
+  pthread_mutex_t lock;
+  uint8_t  active;
+} URING;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int      uring_open(URING *ring, int sqpoll, int zerocopy);
+uint8_t *uring_frame(URING *ring, int *frame, size_t *capacity);
+void     uring_send(URING *ring, int frame, int fd, size_t len, const struct sockaddr_in *dest);
+int      uring_kick(URING *ring);
+int      uring_recv(URING *ring, int fd);
+int      uring_wait_recv(URING *ring, int timeout_ms, int *fd, int *frame, struct sockaddr_in *src);
+void     uring_release(URING *ring, int frame);
+void     uring_close(URING *ring);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define WORKER_POOL_MAX 64
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+typedef void (*POOL_TASK_FN)(void *arg, size_t task);
+
+// pending tasks of one worker: the owner pops from the front, thieves take
+// from the back
+typedef struct {
+  pthread_mutex_t lock;
+  size_t begin;
+  size_t end;
+} POOL_QUEUE;
+
+typedef struct {
+  struct worker_pool *pool;
+  int id;
+} POOL_WORKER;
+
+// Fork/join pool with work stealing.
+// worker_pool_run() splits the task range evenly over the workers (the
+// calling thread is worker 0), a worker whose queue is empty steals from the
+// back of the others, and the call returns once every task has run.
+typedef struct worker_pool {
+  int workers;
+  pthread_t tid[WORKER_POOL_MAX];
+  POOL_QUEUE queue[WORKER_POOL_MAX];
+  POOL_WORKER worker[WORKER_POOL_MAX];
+
+  pthread_mutex_t lock;
+  pthread_cond_t start_cv;
+  pthread_cond_t done_cv;
+  uint64_t generation;
+  uint8_t stop;
+
+  POOL_TASK_FN fn;
+  void *arg;
+  size_t pending;
+} WORKER_POOL;
+
+/*******************************************************************************
+* functions
+*******************************************************************************/
+int  worker_pool_init(WORKER_POOL *pool, int workers);
+void worker_pool_run(WORKER_POOL *pool, POOL_TASK_FN fn, void *arg, size_t tasks);
+void worker_pool_destroy(WORKER_POOL *pool);
+
+#endif
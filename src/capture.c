@@ -0,0 +1,134 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/capture.h"
+
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static void put_16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t) (v >> 8);
+  p[1] = (uint8_t) v;
+}
+
+static uint16_t ip_checksum(const uint8_t *hdr, size_t len)
+{
+  uint32_t sum = 0;
+  size_t i;
+
+  for(i=0; i+1<len; i+=2)
+  {
+    sum += (uint32_t) ((hdr[i] << 8) | hdr[i+1]);
+  }
+  while(sum >> 16)
+  {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return (uint16_t) ~sum;
+}
+
+int capture_open(CAPTURE *cap, const char *path, const char *src_ip, uint16_t src_port, const char *dst_ip)
+{
+  struct in_addr src, dst;
+  uint32_t file_hdr[6];
+
+  memset(cap, 0, sizeof(*cap));
+
+  if(inet_aton(src_ip, &src) == 0 || inet_aton(dst_ip, &dst) == 0)
+  {
+    printf("Invalid capture IP address.\n");
+    return -1;
+  }
+
+  if((cap->f = fopen(path, "wb")) == NULL)
+  {
+    printf("Unable to open capture file %s: %s.\n", path, strerror(errno));
+    return -1;
+  }
+  setvbuf(cap->f, NULL, _IOFBF, CAPTURE_BUFFER);
+
+  // global header in host byte order, readers detect it from the magic
+  file_hdr[0] = CAPTURE_MAGIC_NS;
+  file_hdr[1] = 2 | (4 << 16); // version 2.4
+  file_hdr[2] = 0;             // thiszone
+  file_hdr[3] = 0;             // sigfigs
+  file_hdr[4] = CAPTURE_SNAPLEN;
+  file_hdr[5] = CAPTURE_LINKTYPE;
+
+  if(fwrite(file_hdr, sizeof(file_hdr), 1, cap->f) != 1)
+  {
+    printf("Unable to write capture file %s.\n", path);
+    fclose(cap->f);
+    return -1;
+  }
+
+  cap->src_ip = src.s_addr;
+  cap->dst_ip = dst.s_addr;
+  cap->src_port = src_port;
+  pthread_mutex_init(&(cap->lock), NULL);
+  cap->active = 1;
+
+  printf("Writing data streams to capture file %s.\n", path);
+
+  return 0;
+}
+
+int capture_write(CAPTURE *cap, uint16_t dst_port, const uint8_t *data, size_t len, int64_t stamp_ns)
+{
+  uint8_t hdr[CAPTURE_HDR_SIZE] = {0};
+  uint32_t rec[4];
+  int error_code = 0;
+
+  pthread_mutex_lock(&(cap->lock));
+
+  hdr[0] = 0x45;                                    // IPv4, 20 byte header
+  put_16(hdr + 2, (uint16_t) (CAPTURE_HDR_SIZE + len));
+  put_16(hdr + 4, cap->ip_id++);
+  put_16(hdr + 6, 0x4000);                          // don't fragment
+  hdr[8] = 64;                                      // ttl
+  hdr[9] = 17;                                      // UDP
+  memcpy(hdr + 12, &(cap->src_ip), 4);
+  memcpy(hdr + 16, &(cap->dst_ip), 4);
+  put_16(hdr + 10, ip_checksum(hdr, 20));
+  put_16(hdr + 20, cap->src_port);
+  put_16(hdr + 22, dst_port);
+  put_16(hdr + 24, (uint16_t) (8 + len));           // UDP checksum left at 0
+
+  rec[0] = (uint32_t) (stamp_ns / 1000000000LL);
+  rec[1] = (uint32_t) (stamp_ns % 1000000000LL);
+  rec[2] = (uint32_t) (CAPTURE_HDR_SIZE + len);
+  rec[3] = rec[2];
+
+  if(fwrite(rec, sizeof(rec), 1, cap->f) != 1 || fwrite(hdr, sizeof(hdr), 1, cap->f) != 1 || fwrite(data, len, 1, cap->f) != 1)
+  {
+    error_code = -1;
+  }
+  cap->packets++;
+
+  pthread_mutex_unlock(&(cap->lock));
+
+  return error_code;
+}
+
+void capture_close(CAPTURE *cap)
+{
+  if(!cap->active)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&(cap->lock));
+  fclose(cap->f);
+  cap->active = 0;
+  printf("Closed capture file, %lu packets.\n", cap->packets);
+  pthread_mutex_unlock(&(cap->lock));
+  pthread_mutex_destroy(&(cap->lock));
+
+  return;
+}
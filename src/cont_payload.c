@@ -0,0 +1,125 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/cont_payload.h"
+#include "../include/trace.h"
+
+#include <libutils/utils.h>
+#include <libsmartscan/smartscan_utils.h>
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+uint64_t payload_seed = 0;
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static uint64_t splitmix64(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return z ^ (z >> 31);
+}
+
+// Values depend only on the seed, the sample number and the value position,
+// so any split of a sample over the workers produces the same payload: the
+// splitmix64 state of value i is reached directly as base + i*gamma.
+void create_cont_values(uint8_t *sample, size_t first, size_t count, uint64_t sample_id)
+{
+  uint64_t base = payload_seed ^ (sample_id * 0xd1b54a32d192ed03ULL);
+  uint64_t state = base + (uint64_t) first * 0x9e3779b97f4a7c15ULL;
+  uint64_t rnd;
+  uint16_t tmp16 = 0;
+  int delta;
+  size_t i;
+
+  for(i=first; i<first+count; i++)
+  {
+    rnd = splitmix64(&state);
+    delta = (int) ((rnd >> 32) % 50);
+    // tmp16 = (rand()%400) * LASER_CHANNEL_MULT; // data;
+    tmp16 = (CONT_VALUE_BASE + ((rnd & 1) ? delta : -delta)) * LASER_CHANNEL_MULT; // data;
+    write_16(&tmp16, sample + i*sizeof(uint16_t), BE);
+  }
+
+  return;
+}
+
+void create_cont_sample(uint8_t *sample, size_t len, uint64_t sample_id)
+{
+  create_cont_values(sample, 0, len/sizeof(uint16_t), sample_id);
+
+  return;
+}
+
+// one task per sample: a sample is the smallest unit worth handing to
+// another thread, and it keeps the normals of a layout in one thread cache
+static void cont_batch_task(void *arg, size_t task)
+{
+  CONT_BATCH *batch = (CONT_BATCH *) arg;
+  size_t values = (size_t) batch->channels * batch->gratings;
+  uint8_t channel;
+
+  if(strain_field.active)
+  {
+    for(channel=0; channel<batch->channels; channel++)
+    {
+      strain_field_values(&strain_field, batch->slot[task] + channel * batch->gratings * sizeof(uint16_t),
+                          channel, batch->gratings, batch->id[task]);
+    }
+  }
+  else
+  {
+    create_cont_sample(batch->slot[task], values * sizeof(uint16_t), batch->id[task]);
+  }
+
+  return;
+}
+
+// values of the batch, weighted by the mean factor row of a layout
+size_t cont_batch_work(const CONT_BATCH *batch)
+{
+  size_t work = batch->count * batch->channels * batch->gratings;
+
+  if(strain_field.active)
+  {
+    work *= strain_field.n / 2 + 1;
+  }
+
+  return work;
+}
+
+// cont_th hands over the samples due at each wake, a datagram or two in
+// steady state: those are generated inline, the pool only takes batches
+// large enough to pay for waking it (catch-up after a stall, large layouts)
+void generate_cont_batch(CONT_BATCH *batch, WORKER_POOL *pool)
+{
+  size_t i;
+
+  if(batch->count == 0)
+  {
+    return;
+  }
+
+  TRACE(gen_start, 0, PORT_RX_CONT, batch->count);
+  if(pool && pool->workers > 1 && batch->count > 1 && cont_batch_work(batch) >= CONT_POOL_MIN_WORK)
+  {
+    worker_pool_run(pool, cont_batch_task, batch, batch->count);
+  }
+  else
+  {
+    for(i=0; i<batch->count; i++)
+    {
+      cont_batch_task(batch, i);
+    }
+  }
+  TRACE(gen_end, 0, PORT_RX_CONT, batch->count);
+
+  batch->count = 0;
+
+  return;
+}
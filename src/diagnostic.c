@@ -0,0 +1,356 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/diagnostic.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libutils/utils.h>
+#include <libsmartscan/smartscan_utils.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+static const char *param_name[DIAG_PARAM_NR] = {
+  "operational_after", "fault_ppm", "temp_max", "error_hold_ms", "recovery_ms", "aging_ppm_h", "rx_error_ppm"
+};
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static uint64_t diag_rand(DIAG_MODEL *diag)
+{
+  uint64_t z = (diag->rng += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return z ^ (z >> 31);
+}
+
+// uniform in [-1, 1)
+static double diag_noise(DIAG_MODEL *diag)
+{
+  return (double) (diag_rand(diag) >> 11) / (double) (1ULL << 52) - 1.0;
+}
+
+static int diag_chance(DIAG_MODEL *diag, uint32_t ppm)
+{
+  return (diag_rand(diag) % 1000000) < ppm;
+}
+
+const char *diag_state_name(DIAG_STATE state)
+{
+  switch(state)
+  {
+    case DIAG_STATE_STANDBY:
+      return "stand-by";
+    case DIAG_STATE_OPERATIONAL:
+      return "operational";
+    case DIAG_STATE_ERROR:
+      return "error";
+    case DIAG_STATE_RECOVERY:
+      return "recovery";
+    default:
+      return "unknown";
+  }
+}
+
+static uint8_t wire_state(DIAG_STATE state)
+{
+  switch(state)
+  {
+    case DIAG_STATE_OPERATIONAL:
+      return SSI_STATE_OPERATIONAL;
+#ifdef SSI_STATE_ERROR
+    case DIAG_STATE_ERROR:
+      return SSI_STATE_ERROR;
+#endif
+    default: // a recovering board, or a faulty one when the protocol has no
+             // error code, reports stand-by; -E carries the model state
+      return SSI_STATE_STAND_BY;
+  }
+}
+
+static void set_state(DIAG_MODEL *diag, DIAG_STATE state)
+{
+  if(diag->state != state)
+  {
+    printf("Board state %s -> %s.\n", diag_state_name(diag->state), diag_state_name(state));
+    diag->state = state;
+    diag->state_ms = 0;
+    diag->started |= (state == DIAG_STATE_OPERATIONAL);
+    diag->dirty = 1;
+  }
+
+  *(diag->ssi_state) = wire_state(state);
+  diag->last_ssi_state = *(diag->ssi_state);
+
+  return;
+}
+
+// a state forced by a maintenance message wins over the model
+static void sync_external_state(DIAG_MODEL *diag)
+{
+  uint8_t s = *(diag->ssi_state);
+
+  if(s == diag->last_ssi_state)
+  {
+    return;
+  }
+
+  if(s == SSI_STATE_OPERATIONAL)
+  {
+    set_state(diag, DIAG_STATE_OPERATIONAL);
+  }
+#ifdef SSI_STATE_ERROR
+  else if(s == SSI_STATE_ERROR)
+  {
+    set_state(diag, DIAG_STATE_ERROR);
+  }
+#endif
+  else
+  {
+    set_state(diag, DIAG_STATE_STANDBY);
+  }
+
+  return;
+}
+
+void diag_init(DIAG_MODEL *diag, uint8_t *ssi_state, uint64_t seed, size_t frame_len, int extended)
+{
+  memset(diag, 0, sizeof(*diag));
+  pthread_mutex_init(&(diag->lock), NULL);
+
+  diag->ssi_state = ssi_state;
+  diag->last_ssi_state = *ssi_state;
+  diag->state = (*ssi_state == SSI_STATE_OPERATIONAL ? DIAG_STATE_OPERATIONAL : DIAG_STATE_STANDBY);
+  diag->started = (diag->state == DIAG_STATE_OPERATIONAL);
+  diag->param.operational_after = DIAG_OPERATIONAL_AFTER;
+  diag->param.fault_ppm = DIAG_FAULT_PPM;
+  diag->param.temp_max_c = DIAG_TEMP_MAX_C;
+  diag->param.error_hold_ms = DIAG_ERROR_HOLD_MS;
+  diag->param.recovery_ms = DIAG_RECOVERY_MS;
+  diag->param.aging_ppm_h = DIAG_LASER_AGING_PPM_H;
+  diag->param.rx_error_ppm = DIAG_RX_ERROR_PPM;
+  diag->temp_c = DIAG_TEMP_AMBIENT_C;
+  diag->laser_uw = DIAG_LASER_NOMINAL_UW;
+  diag->rng = seed;
+  diag->base_len = (frame_len + DIAG_EXT_SIZE <= DIAG_FRAME_MAX ? frame_len : DIAG_FRAME_MAX - DIAG_EXT_SIZE);
+  diag->frame_len = diag->base_len + (extended ? DIAG_EXT_SIZE : 0);
+  diag->dirty = 1;
+
+  return;
+}
+
+// index of the parameter in param_name if value is in its range, -1 otherwise
+int diag_check(const char *name, double value)
+{
+  int i;
+
+  for(i=0; i<DIAG_PARAM_NR && strcmp(name, param_name[i]) != 0; i++);
+
+  if(i == DIAG_PARAM_NR)
+  {
+    printf("Unknown health model parameter %s.\n", name);
+    return -1;
+  }
+
+  if(value < 0.0 || value > (double) UINT32_MAX || ((i == DIAG_P_FAULT_PPM || i == DIAG_P_RX_ERROR_PPM) && value > 1000000.0))
+  {
+    printf("Invalid value %g for health model parameter %s.\n", value, name);
+    return -1;
+  }
+
+  return i;
+}
+
+// parameter by its name in param_name, e.g. to inject faults from a scenario
+int diag_set(DIAG_MODEL *diag, const char *name, double value)
+{
+  int i;
+
+  if((i = diag_check(name, value)) < 0)
+  {
+    return -1;
+  }
+
+  pthread_mutex_lock(&(diag->lock));
+  switch(i)
+  {
+    case DIAG_P_OPERATIONAL_AFTER:
+      diag->param.operational_after = (uint32_t) value;
+      break;
+    case DIAG_P_FAULT_PPM:
+      diag->param.fault_ppm = (uint32_t) value;
+      break;
+    case DIAG_P_TEMP_MAX:
+      diag->param.temp_max_c = value;
+      break;
+    case DIAG_P_ERROR_HOLD:
+      diag->param.error_hold_ms = (uint32_t) value;
+      break;
+    case DIAG_P_RECOVERY:
+      diag->param.recovery_ms = (uint32_t) value;
+      break;
+    case DIAG_P_AGING:
+      diag->param.aging_ppm_h = value;
+      break;
+    default:
+      diag->param.rx_error_ppm = (uint32_t) value;
+      break;
+  }
+  pthread_mutex_unlock(&(diag->lock));
+
+  printf("Health model %s set to %g.\n", name, value);
+
+  return 0;
+}
+
+void diag_on_request(DIAG_MODEL *diag)
+{
+  pthread_mutex_lock(&(diag->lock));
+
+  sync_external_state(diag);
+
+  // the board leaves stand-by by itself once, when the requests reach
+  // operational_after (0 or 1: the first one); a stand-by forced later by
+  // a maintenance message is kept
+  diag->requests++;
+  if(diag->state == DIAG_STATE_STANDBY && !diag->started && diag->requests >= diag->param.operational_after)
+  {
+    set_state(diag, DIAG_STATE_OPERATIONAL);
+  }
+
+  pthread_mutex_unlock(&(diag->lock));
+
+  return;
+}
+
+void diag_step(DIAG_MODEL *diag, int64_t dt_ms)
+{
+  double dt_s = (double) dt_ms / 1000.0;
+  double target_c;
+
+  pthread_mutex_lock(&(diag->lock));
+
+  sync_external_state(diag);
+
+  diag->state_ms += dt_ms;
+  diag->uptime_s += dt_s;
+
+  // first order thermal model towards ambient plus the load heating
+  target_c = DIAG_TEMP_AMBIENT_C + (diag->state == DIAG_STATE_OPERATIONAL ? DIAG_TEMP_LOAD_C : 0.0);
+  diag->temp_c += (target_c - diag->temp_c) * dt_s / DIAG_TEMP_TAU_S + 0.05 * diag_noise(diag);
+
+  // slow aging while the laser is on, power collapses on a fault
+  if(diag->state == DIAG_STATE_OPERATIONAL)
+  {
+    diag->laser_uw -= diag->laser_uw * diag->param.aging_ppm_h * 1e-6 * dt_s / 3600.0;
+  }
+  diag->laser_uw += 2.0 * diag_noise(diag);
+
+  if(diag_chance(diag, diag->param.rx_error_ppm))
+  {
+    diag->rx_errors++;
+    diag->dirty = 1;
+  }
+
+  switch(diag->state)
+  {
+    case DIAG_STATE_OPERATIONAL:
+      if(diag->temp_c > diag->param.temp_max_c || diag_chance(diag, diag->param.fault_ppm))
+      {
+        diag->errors++;
+        set_state(diag, DIAG_STATE_ERROR);
+      }
+      break;
+    case DIAG_STATE_ERROR:
+      if(diag->state_ms >= diag->param.error_hold_ms)
+      {
+        set_state(diag, DIAG_STATE_RECOVERY);
+      }
+      break;
+    case DIAG_STATE_RECOVERY:
+      if(diag->state_ms >= diag->param.recovery_ms)
+      {
+        set_state(diag, DIAG_STATE_OPERATIONAL);
+      }
+      break;
+    default:
+      break;
+  }
+
+  if((int16_t) (diag->temp_c * 100.0) != diag->q_temp ||
+     (uint16_t) (diag->state == DIAG_STATE_ERROR ? 0.0 : diag->laser_uw) != diag->q_laser ||
+     (uint32_t) diag->uptime_s != diag->q_uptime)
+  {
+    diag->dirty = 1;
+  }
+
+  pthread_mutex_unlock(&(diag->lock));
+
+  return;
+}
+
+static void encode(DIAG_MODEL *diag)
+{
+  uint8_t *ext;
+  uint32_t tmp32;
+  uint16_t tmp16;
+  uint8_t tmp8;
+
+  diag->q_temp = (int16_t) (diag->temp_c * 100.0);
+  diag->q_laser = (uint16_t) (diag->state == DIAG_STATE_ERROR ? 0.0 : diag->laser_uw);
+  diag->q_uptime = (uint32_t) diag->uptime_s;
+
+  if(ssi_create_diagnostic_msg(diag->frame, diag->base_len, wire_state(diag->state)) != STATUS_OK)
+  {
+    memset(diag->frame, 0, diag->base_len);
+  }
+
+  if(diag->frame_len >= diag->base_len + DIAG_EXT_SIZE)
+  {
+    ext = diag->frame + diag->base_len;
+    tmp16 = (uint16_t) diag->q_temp;
+    write_16(&tmp16, ext + DIAG_EXT_TEMP, BE);
+    tmp16 = diag->q_laser;
+    write_16(&tmp16, ext + DIAG_EXT_LASER, BE);
+    tmp32 = diag->errors;
+    write_32(&tmp32, ext + DIAG_EXT_ERRORS, BE);
+    tmp32 = diag->rx_errors;
+    write_32(&tmp32, ext + DIAG_EXT_RX_ERRORS, BE);
+    tmp32 = diag->q_uptime;
+    write_32(&tmp32, ext + DIAG_EXT_UPTIME, BE);
+    tmp8 = (uint8_t) diag->state;
+    write_8(&tmp8, ext + DIAG_EXT_MODEL_STATE);
+  }
+
+  diag->encodings++;
+  diag->dirty = 0;
+
+  return;
+}
+
+// copy of the cached frame, encoded again only if something changed
+size_t diag_frame(DIAG_MODEL *diag, uint8_t *message, size_t len)
+{
+  size_t frame_len;
+
+  pthread_mutex_lock(&(diag->lock));
+
+  sync_external_state(diag);
+
+  if(diag->dirty)
+  {
+    encode(diag);
+  }
+
+  frame_len = (len < diag->frame_len ? len : diag->frame_len);
+  memcpy(message, diag->frame, frame_len);
+
+  pthread_mutex_unlock(&(diag->lock));
+
+  return frame_len;
+}
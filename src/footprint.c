@@ -0,0 +1,90 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/footprint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+static int thread_count = 0; // threads started through footprint_thread_create
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+// every allocation happens at startup: one arena is enough and keeps glibc
+// from reserving a 64 MB arena per thread
+void footprint_init()
+{
+#if EMU_EMBEDDED && defined(__GLIBC__)
+  mallopt(M_ARENA_MAX, 1);
+#endif
+
+  return;
+}
+
+int footprint_thread_create(pthread_t *tid, void *(*fn)(void *), void *arg)
+{
+  pthread_attr_t attr;
+  int error_code;
+
+  pthread_attr_init(&attr);
+  if(FOOTPRINT_THREAD_STACK > 0)
+  {
+    pthread_attr_setstacksize(&attr, FOOTPRINT_THREAD_STACK < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : FOOTPRINT_THREAD_STACK);
+  }
+
+  if((error_code = pthread_create(tid, &attr, fn, arg)) == 0)
+  {
+    __atomic_fetch_add(&thread_count, 1, __ATOMIC_RELAXED);
+  }
+  pthread_attr_destroy(&attr);
+
+  return error_code;
+}
+
+// resident and peak memory from /proc, heap in use from the allocator
+void footprint_report(const char *when)
+{
+  FILE *f;
+  char line[128], stack[32] = "default";
+  long rss_kb = -1, hwm_kb = -1, value;
+  size_t heap = 0;
+
+  if((f = fopen("/proc/self/status", "r")) != NULL)
+  {
+    while(fgets(line, sizeof(line), f))
+    {
+      if(sscanf(line, "VmRSS: %ld kB", &value) == 1)
+      {
+        rss_kb = value;
+      }
+      else if(sscanf(line, "VmHWM: %ld kB", &value) == 1)
+      {
+        hwm_kb = value;
+      }
+    }
+    fclose(f);
+  }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  heap = mallinfo2().uordblks;
+#endif
+
+  if(FOOTPRINT_THREAD_STACK > 0)
+  {
+    snprintf(stack, sizeof(stack), "%d kB", FOOTPRINT_THREAD_STACK / 1024);
+  }
+
+  printf("Memory at %s: resident %ld kB, peak %ld kB, heap in use %zu kB, %d threads with %s stacks.\n",
+         when, rss_kb, hwm_kb, heap / 1024, thread_count, stack);
+
+  return;
+}
@@ -0,0 +1,336 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/raw_tx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static uint32_t sum_16(const uint8_t *data, size_t len)
+{
+  uint32_t sum = 0;
+  size_t i;
+
+  for(i=0; i+1<len; i+=2)
+  {
+    sum += (uint32_t) ((data[i] << 8) | data[i+1]);
+  }
+
+  return sum;
+}
+
+static uint16_t fold_checksum(uint32_t sum)
+{
+  while(sum >> 16)
+  {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return (uint16_t) ~sum;
+}
+
+// destination MAC from the kernel neighbour table
+static int lookup_arp(const char *ip, const char *ifname, uint8_t *mac)
+{
+  FILE *f;
+  char line[256], a_ip[64], a_mac[64], a_dev[IF_NAMESIZE + 1];
+  unsigned int m[ETH_ALEN];
+  int found = 0, i;
+
+  if((f = fopen("/proc/net/arp", "r")) == NULL)
+  {
+    return 0;
+  }
+
+  while(!found && fgets(line, sizeof(line), f))
+  {
+    if(sscanf(line, "%63s %*s %*s %63s %*s %16s", a_ip, a_mac, a_dev) == 3 && strcmp(a_ip, ip) == 0 && strcmp(a_dev, ifname) == 0)
+    {
+      if(sscanf(a_mac, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) == ETH_ALEN)
+      {
+        for(i=0; i<ETH_ALEN; i++)
+        {
+          mac[i] = (uint8_t) m[i];
+        }
+        found = 1;
+      }
+    }
+  }
+
+  fclose(f);
+
+  return found;
+}
+
+static int parse_mac(const char *str, uint8_t *mac)
+{
+  unsigned int m[ETH_ALEN];
+  int i;
+
+  if(sscanf(str, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != ETH_ALEN)
+  {
+    return 0;
+  }
+
+  for(i=0; i<ETH_ALEN; i++)
+  {
+    mac[i] = (uint8_t) m[i];
+  }
+
+  return 1;
+}
+
+int raw_tx_open(RAW_TX *tx, const char *ifname, const char *src_ip, uint16_t src_port, const char *dst_mac)
+{
+  struct tpacket_req req;
+  struct sockaddr_ll sll;
+  struct ifreq ifr;
+  int version = TPACKET_V2;
+
+  memset(tx, 0, sizeof(*tx));
+  tx->fd = -1;
+
+  if(inet_aton(src_ip, &(tx->src_ip)) == 0)
+  {
+    printf("Invalid raw TX source IP address.\n");
+    return -1;
+  }
+  tx->src_port = src_port;
+
+  if(dst_mac)
+  {
+    if(!parse_mac(dst_mac, tx->dst_mac))
+    {
+      printf("Invalid raw TX destination MAC address.\n");
+      return -1;
+    }
+    tx->dst_mac_set = 1;
+  }
+
+  if((tx->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP))) == -1)
+  {
+    printf("Unable to open raw TX socket (%s).\n", strerror(errno));
+    return -1;
+  }
+
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, IF_NAMESIZE - 1);
+  if(ioctl(tx->fd, SIOCGIFINDEX, &ifr) == -1)
+  {
+    printf("Unknown raw TX interface %s.\n", ifname);
+    raw_tx_close(tx);
+    return -1;
+  }
+  tx->ifindex = ifr.ifr_ifindex;
+
+  if(ioctl(tx->fd, SIOCGIFHWADDR, &ifr) == -1)
+  {
+    printf("Unable to read MAC address of %s.\n", ifname);
+    raw_tx_close(tx);
+    return -1;
+  }
+  memcpy(tx->src_mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+  // TPACKET_V3 only changes the RX side (block batching), TX frames are
+  // handled one by one in both versions
+  if(setsockopt(tx->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+  {
+    printf("Unable to set TPACKET_V2 (%s).\n", strerror(errno));
+    raw_tx_close(tx);
+    return -1;
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = RAW_TX_BLOCK_SIZE;
+  req.tp_frame_size = RAW_TX_FRAME_SIZE;
+  req.tp_frame_nr = RAW_TX_FRAME_NR;
+  req.tp_block_nr = RAW_TX_FRAME_NR / (RAW_TX_BLOCK_SIZE / RAW_TX_FRAME_SIZE);
+
+  if(setsockopt(tx->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1)
+  {
+    printf("Unable to set up PACKET_TX_RING (%s).\n", strerror(errno));
+    raw_tx_close(tx);
+    return -1;
+  }
+
+  tx->frame_nr = req.tp_frame_nr;
+  tx->ring_size = (size_t) req.tp_block_size * req.tp_block_nr;
+  tx->ring = (uint8_t *) mmap(NULL, tx->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, tx->fd, 0);
+  if(tx->ring == MAP_FAILED)
+  {
+    tx->ring = NULL;
+    printf("Unable to map TX ring (%s).\n", strerror(errno));
+    raw_tx_close(tx);
+    return -1;
+  }
+
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_IP);
+  sll.sll_ifindex = tx->ifindex;
+  if(bind(tx->fd, (struct sockaddr *) &sll, sizeof(sll)) == -1)
+  {
+    printf("Unable to bind raw TX socket to %s (%s).\n", ifname, strerror(errno));
+    raw_tx_close(tx);
+    return -1;
+  }
+
+  tx->active = 1;
+
+  printf("Raw TX ring on %s: %u frames of %d bytes.\n", ifname, tx->frame_nr, RAW_TX_FRAME_SIZE);
+
+  return 0;
+}
+
+// returns the destination index to pass to raw_tx_commit()
+int raw_tx_add_dest(RAW_TX *tx, const char *dst_ip, uint16_t dst_port)
+{
+  RAW_TX_DEST *d;
+  struct ether_header *eth;
+  struct iphdr *ip;
+  struct udphdr *udp;
+  struct in_addr addr;
+  char ifname[IF_NAMESIZE];
+  uint8_t mac[ETH_ALEN];
+
+  if(!tx->active || tx->dest_nr >= RAW_TX_MAX_DEST)
+  {
+    return -1;
+  }
+
+  if(inet_aton(dst_ip, &addr) == 0)
+  {
+    printf("Invalid raw TX destination IP address.\n");
+    return -1;
+  }
+
+  memcpy(mac, tx->dst_mac, ETH_ALEN);
+  if(!tx->dst_mac_set)
+  {
+    if(!if_indextoname(tx->ifindex, ifname) || !lookup_arp(dst_ip, ifname, mac))
+    {
+      printf("No neighbour entry for %s, set the destination MAC.\n", dst_ip);
+      return -1;
+    }
+  }
+
+  d = &(tx->dest[tx->dest_nr]);
+  memset(d, 0, sizeof(*d));
+
+  eth = (struct ether_header *) d->header;
+  memcpy(eth->ether_dhost, mac, ETH_ALEN);
+  memcpy(eth->ether_shost, tx->src_mac, ETH_ALEN);
+  eth->ether_type = htons(ETHERTYPE_IP);
+
+  ip = (struct iphdr *) (d->header + sizeof(struct ether_header));
+  ip->version = 4;
+  ip->ihl = 5;
+  ip->ttl = 64;
+  ip->protocol = IPPROTO_UDP;
+  ip->frag_off = htons(IP_DF);
+  ip->saddr = tx->src_ip.s_addr;
+  ip->daddr = addr.s_addr;
+  // tot_len, id and check are zero here: they are added per packet
+  d->ip_partial_sum = sum_16((uint8_t *) ip, sizeof(struct iphdr));
+
+  udp = (struct udphdr *) (d->header + sizeof(struct ether_header) + sizeof(struct iphdr));
+  udp->source = htons(tx->src_port);
+  udp->dest = htons(dst_port);
+  udp->check = 0; // optional for IPv4
+
+  return tx->dest_nr++;
+}
+
+// payload area of the next free frame, NULL when the kernel still owns it
+uint8_t *raw_tx_frame(RAW_TX *tx, size_t *capacity)
+{
+  struct tpacket2_hdr *hdr = (struct tpacket2_hdr *) (tx->ring + (size_t) tx->current * RAW_TX_FRAME_SIZE);
+  size_t data_off = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+  if(__atomic_load_n(&(hdr->tp_status), __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE)
+  {
+    return NULL;
+  }
+
+  *capacity = RAW_TX_FRAME_SIZE - data_off - RAW_TX_HDR_SIZE;
+
+  return (uint8_t *) hdr + data_off + RAW_TX_HDR_SIZE;
+}
+
+// complete headers around a payload built by raw_tx_frame()
+void raw_tx_commit(RAW_TX *tx, int dest, size_t len)
+{
+  struct tpacket2_hdr *hdr = (struct tpacket2_hdr *) (tx->ring + (size_t) tx->current * RAW_TX_FRAME_SIZE);
+  uint8_t *frame = (uint8_t *) hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+  RAW_TX_DEST *d = &(tx->dest[dest]);
+  struct iphdr *ip;
+  struct udphdr *udp;
+  uint16_t tot_len = (uint16_t) (sizeof(struct iphdr) + sizeof(struct udphdr) + len);
+  uint16_t id = tx->ip_id++;
+
+  memcpy(frame, d->header, RAW_TX_HDR_SIZE);
+
+  ip = (struct iphdr *) (frame + sizeof(struct ether_header));
+  ip->tot_len = htons(tot_len);
+  ip->id = htons(id);
+  ip->check = htons(fold_checksum(d->ip_partial_sum + tot_len + id));
+
+  udp = (struct udphdr *) (frame + sizeof(struct ether_header) + sizeof(struct iphdr));
+  udp->len = htons((uint16_t) (sizeof(struct udphdr) + len));
+
+  hdr->tp_len = (uint32_t) (RAW_TX_HDR_SIZE + len);
+  __atomic_store_n(&(hdr->tp_status), TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+  tx->current = (tx->current + 1) % tx->frame_nr;
+  tx->queued++;
+
+  return;
+}
+
+// hand every committed frame to the kernel with one system call
+int raw_tx_kick(RAW_TX *tx)
+{
+  if(tx->queued == 0)
+  {
+    return 0;
+  }
+
+  if(send(tx->fd, NULL, 0, MSG_DONTWAIT) == -1 && errno != EAGAIN && errno != ENOBUFS)
+  {
+    printf("Raw TX kick failed (%s).\n", strerror(errno));
+    return -1;
+  }
+
+  tx->queued = 0;
+
+  return 0;
+}
+
+void raw_tx_close(RAW_TX *tx)
+{
+  if(tx->ring)
+  {
+    munmap(tx->ring, tx->ring_size);
+    tx->ring = NULL;
+  }
+
+  if(tx->fd != -1)
+  {
+    close(tx->fd);
+    tx->fd = -1;
+  }
+
+  tx->active = 0;
+
+  return;
+}
@@ -0,0 +1,81 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/sample_ring.h"
+
+#include <stdio.h>
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+// drop every pending sample and resize the slots for a new channel format
+int sample_ring_reset(SAMPLE_RING *ring, uint8_t channels, uint8_t gratings)
+{
+  ring->channels = channels;
+  ring->gratings = gratings;
+  ring->sample_size = (size_t) channels * gratings * sizeof(uint16_t);
+  ring->capacity = ring->sample_size ? SAMPLE_RING_BYTES / ring->sample_size : 0;
+  ring->head = 0;
+  ring->tail = 0;
+
+  if(ring->capacity == 0)
+  {
+    printf("Invalid channel format %ux%u for sample ring.\n", channels, gratings);
+    return -1;
+  }
+
+  return 0;
+}
+
+size_t sample_ring_count(const SAMPLE_RING *ring)
+{
+  return (size_t) (ring->head - ring->tail);
+}
+
+// reserve the slot of the next sample, NULL when the ring is full
+uint8_t *sample_ring_push(SAMPLE_RING *ring, const struct timespec *stamp, int64_t deadline_ns)
+{
+  size_t slot;
+
+  if(sample_ring_count(ring) >= ring->capacity)
+  {
+    return NULL;
+  }
+
+  slot = ring->head % ring->capacity;
+  ring->stamp[slot] = *stamp;
+  ring->deadline_ns[slot] = deadline_ns;
+  ring->head++;
+
+  return ring->data + slot * ring->sample_size;
+}
+
+// offset-th pending sample counted from the oldest one
+uint8_t *sample_ring_peek(SAMPLE_RING *ring, size_t offset)
+{
+  if(offset >= sample_ring_count(ring))
+  {
+    return NULL;
+  }
+
+  return ring->data + ((ring->tail + offset) % ring->capacity) * ring->sample_size;
+}
+
+const struct timespec *sample_ring_stamp(const SAMPLE_RING *ring, size_t offset)
+{
+  return &(ring->stamp[(ring->tail + offset) % ring->capacity]);
+}
+
+int64_t sample_ring_deadline(const SAMPLE_RING *ring, size_t offset)
+{
+  return ring->deadline_ns[(ring->tail + offset) % ring->capacity];
+}
+
+void sample_ring_pop(SAMPLE_RING *ring, size_t count)
+{
+  size_t pending = sample_ring_count(ring);
+
+  ring->tail += (count < pending ? count : pending);
+
+  return;
+}
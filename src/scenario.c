@@ -0,0 +1,315 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/scenario.h"
+#include "../include/stream_clock.h"
+#include "../include/diagnostic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include <libsmartscan/smartscan_utils.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+static const char *param_name[SCN_PARAMS] = {
+  "cont_rate", "scan_rate", "scan_time", "chanformat", "state", "demo",
+  "operational_after", "fault_ppm", "temp_max", "error_hold_ms", "recovery_ms", "aging_ppm_h", "rx_error_ppm",
+  "stop"
+};
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+const char *scenario_param_name(uint8_t param)
+{
+  return (param < SCN_PARAMS ? param_name[param] : "unknown");
+}
+
+static int parse_param(const char *name)
+{
+  int i;
+
+  for(i=0; i<SCN_PARAMS; i++)
+  {
+    if(strcasecmp(name, param_name[i]) == 0)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// the range of the field the value is written to, checked when the file is
+// loaded so that a bad timeline never starts
+static int check_value(int param, long value)
+{
+  long min = 0, max;
+
+  switch(param)
+  {
+    case SCN_CONT_RATE:
+    case SCN_SCAN_RATE:
+      max = UINT16_MAX;
+      break;
+    case SCN_SCAN_TIME:
+      min = 1;
+      max = UINT16_MAX;
+      break;
+    case SCN_STATE:
+    case SCN_DEMO:
+      max = UINT8_MAX;
+      break;
+    default: // health model parameters, in the ranges of diag_set
+      return (value <= INT32_MAX && diag_check(param_name[param], (double) value) >= 0) ? 0 : -1;
+  }
+
+  if(value < min || value > max)
+  {
+    printf("Value %ld out of range [%ld, %ld] for %s.\n", value, min, max, param_name[param]);
+    return -1;
+  }
+
+  return 0;
+}
+
+// values are numbers, except chanformat (CxG) and state (name or number)
+static int parse_value(int param, const char *str, int32_t *value)
+{
+  unsigned int channels, gratings;
+  long number;
+  char *end;
+
+  if(param == SCN_CHANFORMAT)
+  {
+    if(sscanf(str, "%ux%u", &channels, &gratings) != 2 || channels > 15 || gratings > 31)
+    {
+      return -1;
+    }
+    *value = (int32_t) ((channels << 8) | gratings);
+    return 0;
+  }
+
+  if(param == SCN_STATE)
+  {
+    if(strcasecmp(str, "standby") == 0)
+    {
+      *value = SSI_STATE_STAND_BY;
+      return 0;
+    }
+    if(strcasecmp(str, "operational") == 0)
+    {
+      *value = SSI_STATE_OPERATIONAL;
+      return 0;
+    }
+  }
+
+  number = strtol(str, &end, 10);
+  if(*end != '\0' || end == str)
+  {
+    return -1;
+  }
+  if(check_value(param, number) != 0)
+  {
+    return -1;
+  }
+  *value = (int32_t) number;
+
+  return 0;
+}
+
+static int add_step(SCENARIO *scn, double at_s, int param, int32_t value)
+{
+  if(scn->count >= SCENARIO_MAX_STEPS)
+  {
+    printf("Scenario has more than %d steps.\n", SCENARIO_MAX_STEPS);
+    return -1;
+  }
+
+  scn->step[scn->count].at_ns = (int64_t) (at_s * 1e9);
+  scn->step[scn->count].seq = (uint32_t) scn->count;
+  scn->step[scn->count].param = (uint8_t) param;
+  scn->step[scn->count].value = value;
+  scn->count++;
+
+  return 0;
+}
+
+// Linear ramp in equal steps: one per integer value for short ranges, at
+// most SCENARIO_RAMP_STEPS and one per SCENARIO_RAMP_MIN_MS otherwise, the
+// value rounded at each step. The last step lands on 'to' at the end.
+static int add_ramp(SCENARIO *scn, double at_s, int param, int32_t from, int32_t to, double duration_s)
+{
+  int64_t range = (int64_t) to - from, k, steps = (range < 0 ? -range : range);
+  int error_code = add_step(scn, at_s, param, from);
+
+  if(steps > SCENARIO_RAMP_STEPS)
+  {
+    steps = SCENARIO_RAMP_STEPS;
+  }
+  if(steps > (int64_t) (duration_s * 1000.0 / SCENARIO_RAMP_MIN_MS))
+  {
+    steps = (int64_t) (duration_s * 1000.0 / SCENARIO_RAMP_MIN_MS);
+  }
+  if(steps < 1)
+  {
+    steps = 1;
+  }
+
+  for(k=1; error_code == 0 && k<=steps; k++)
+  {
+    error_code = add_step(scn, at_s + duration_s * (double) k / (double) steps, param,
+                          (int32_t) (from + llround((double) range * (double) k / (double) steps)));
+  }
+
+  return error_code;
+}
+
+static int compare_steps(const void *a, const void *b)
+{
+  const SCENARIO_STEP *sa = (const SCENARIO_STEP *) a;
+  const SCENARIO_STEP *sb = (const SCENARIO_STEP *) b;
+
+  if(sa->at_ns != sb->at_ns)
+  {
+    return (sa->at_ns > sb->at_ns) - (sa->at_ns < sb->at_ns);
+  }
+
+  return (sa->seq > sb->seq) - (sa->seq < sb->seq);
+}
+
+// Each line is '<time_s> <action> <param> <args>':
+//   <t> set   <param> <value>
+//   <t> ramp  <param> <from> <to> <duration_s>
+//   <t> burst <param> <value> <duration_s> <restore_value>
+//   <t> stop
+// params: cont_rate, scan_rate (Hz), scan_time (us), chanformat (CxG),
+// state (standby, operational or a number), demo and the health model
+// parameters of diag_set (fault_ppm, temp_max, ...). '#' starts a comment.
+int scenario_load(SCENARIO *scn, const char *path)
+{
+  FILE *f;
+  char line[SCENARIO_LINE_SIZE], action[32], name[32], a1[32], a2[32], a3[32], a4[32]; // a4 catches trailing garbage
+  double at_s, duration_s;
+  int32_t v1, v2;
+  int param, fields, line_nr = 0, error_code = 0;
+  char *comment;
+
+  scn->count = 0;
+  scn->next = 0;
+
+  if((f = fopen(path, "r")) == NULL)
+  {
+    printf("Unable to open scenario %s.\n", path);
+    return -1;
+  }
+
+  while(error_code == 0 && fgets(line, sizeof(line), f))
+  {
+    line_nr++;
+
+    if((comment = strchr(line, '#')) != NULL)
+    {
+      *comment = '\0';
+    }
+
+    fields = sscanf(line, "%lf %31s %31s %31s %31s %31s %31s", &at_s, action, name, a1, a2, a3, a4);
+    if(fields <= 0)
+    {
+      continue;
+    }
+
+    if(fields >= 2 && strcasecmp(action, "stop") == 0)
+    {
+      error_code = add_step(scn, at_s, SCN_STOP, 0);
+      continue;
+    }
+
+    param = (fields >= 3 ? parse_param(name) : -1);
+    if(param < 0 || param == SCN_STOP || at_s < 0)
+    {
+      error_code = -1;
+    }
+    else if(strcasecmp(action, "set") == 0 && fields == 4 && parse_value(param, a1, &v1) == 0)
+    {
+      error_code = add_step(scn, at_s, param, v1);
+    }
+    else if(strcasecmp(action, "ramp") == 0 && fields == 6 && param != SCN_CHANFORMAT && param != SCN_STATE &&
+            parse_value(param, a1, &v1) == 0 && parse_value(param, a2, &v2) == 0 && (duration_s = atof(a3)) > 0)
+    {
+      error_code = add_ramp(scn, at_s, param, v1, v2, duration_s);
+    }
+    else if(strcasecmp(action, "burst") == 0 && fields == 6 &&
+            parse_value(param, a1, &v1) == 0 && parse_value(param, a3, &v2) == 0 && (duration_s = atof(a2)) > 0)
+    {
+      error_code = add_step(scn, at_s, param, v1);
+      if(error_code == 0)
+      {
+        error_code = add_step(scn, at_s + duration_s, param, v2);
+      }
+    }
+    else
+    {
+      error_code = -1;
+    }
+
+    if(error_code != 0)
+    {
+      printf("Invalid scenario step at %s:%d.\n", path, line_nr);
+    }
+  }
+
+  fclose(f);
+
+  if(error_code == 0)
+  {
+    qsort(scn->step, scn->count, sizeof(SCENARIO_STEP), compare_steps);
+    printf("Scenario %s loaded: %zu steps over %.3f s.\n", path, scn->count,
+      scn->count ? (double) scn->step[scn->count - 1].at_ns / 1e9 : 0.0);
+  }
+
+  return error_code;
+}
+
+// a run without a stop step goes on until the emulator is interrupted
+int scenario_has_stop(const SCENARIO *scn)
+{
+  size_t i;
+
+  for(i=0; i<scn->count; i++)
+  {
+    if(scn->step[i].param == SCN_STOP)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// apply every step at its deadline on CLOCK_MONOTONIC, the clock pacing
+// the streams
+void scenario_run(SCENARIO *scn, SCENARIO_APPLY_FN apply, volatile sig_atomic_t *stop)
+{
+  STREAM_CLOCK clk = {0};
+  SCENARIO_STEP *st;
+
+  stream_clock_start(&clk, 0);
+
+  for(scn->next = 0; scn->next < scn->count && !*stop; scn->next++)
+  {
+    st = &(scn->step[scn->next]);
+
+    stream_clock_wait_until(&clk, clk.mono_epoch_ns + st->at_ns);
+
+    printf("Scenario step at %.3f s: %s %d.\n", (double) st->at_ns / 1e9, scenario_param_name(st->param), st->value);
+    apply(st->param, st->value);
+  }
+
+  return;
+}
@@ -0,0 +1,262 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/shm_ring.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+// shared futex: the word lives in a mapping seen by two processes
+static long futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static SHM_RING_SLOT *slot_at(SHM_RING *ring, uint64_t n)
+{
+  return (SHM_RING_SLOT *) (ring->slots + (n & (ring->hdr->slot_nr - 1)) * ring->hdr->slot_size);
+}
+
+static int map_segment(SHM_RING *ring, const char *name, int fd, size_t size)
+{
+  void *base;
+
+  if((base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    printf("Unable to map shared memory ring %s: %s.\n", name, strerror(errno));
+    return -1;
+  }
+
+  ring->hdr = (SHM_RING_HDR *) base;
+  ring->slots = (uint8_t *) base + SHM_RING_HDR_SIZE;
+  ring->size = size;
+  strncpy(ring->name, name, SHM_RING_NAME_LEN - 1);
+  ring->name[SHM_RING_NAME_LEN - 1] = '\0';
+
+  return 0;
+}
+
+int shm_ring_create(SHM_RING *ring, const char *name, uint32_t stream)
+{
+  size_t size = SHM_RING_HDR_SIZE + (size_t) SHM_RING_SLOT_NR * SHM_RING_SLOT_SIZE;
+  int fd;
+
+  memset(ring, 0, sizeof(*ring));
+
+  // a stale segment of a previous run would keep its old readers attached
+  shm_unlink(name);
+
+  if((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0660)) == -1)
+  {
+    printf("Unable to create shared memory ring %s: %s.\n", name, strerror(errno));
+    return -1;
+  }
+
+  if(ftruncate(fd, (off_t) size) == -1 || map_segment(ring, name, fd, size) != 0)
+  {
+    printf("Unable to size shared memory ring %s.\n", name);
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  close(fd);
+
+  memset(ring->hdr, 0, SHM_RING_HDR_SIZE);
+  ring->hdr->version = SHM_RING_VERSION;
+  ring->hdr->slot_size = SHM_RING_SLOT_SIZE;
+  ring->hdr->slot_nr = SHM_RING_SLOT_NR;
+  ring->hdr->stream = stream;
+  ring->hdr->state = 1;
+  __atomic_store_n(&(ring->hdr->magic), SHM_RING_MAGIC, __ATOMIC_RELEASE); // readers check it last
+
+  ring->owner = 1;
+  ring->active = 1;
+
+  printf("Open shared memory ring %s (%u slots of %u bytes).\n", name, SHM_RING_SLOT_NR, SHM_RING_SLOT_SIZE);
+
+  return 0;
+}
+
+int shm_ring_attach(SHM_RING *ring, const char *name)
+{
+  struct stat st;
+  int fd;
+
+  memset(ring, 0, sizeof(*ring));
+
+  if((fd = shm_open(name, O_RDWR, 0)) == -1)
+  {
+    return -1;
+  }
+
+  if(fstat(fd, &st) == -1 || (size_t) st.st_size < SHM_RING_HDR_SIZE || map_segment(ring, name, fd, (size_t) st.st_size) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  if(__atomic_load_n(&(ring->hdr->magic), __ATOMIC_ACQUIRE) != SHM_RING_MAGIC || ring->hdr->version != SHM_RING_VERSION ||
+     ring->hdr->slot_nr == 0 || (ring->hdr->slot_nr & (ring->hdr->slot_nr - 1)) != 0 ||
+     SHM_RING_HDR_SIZE + (size_t) ring->hdr->slot_nr * ring->hdr->slot_size > ring->size)
+  {
+    printf("Shared memory ring %s has an unknown layout.\n", name);
+    munmap(ring->hdr, ring->size);
+    memset(ring, 0, sizeof(*ring));
+    return -1;
+  }
+
+  ring->tail = __atomic_load_n(&(ring->hdr->tail), __ATOMIC_ACQUIRE);
+  ring->head = ring->tail;
+  ring->active = 1;
+
+  return 0;
+}
+
+// next free slot of the producer, NULL when the consumer is slot_nr behind
+uint8_t *shm_ring_frame(SHM_RING *ring, size_t *capacity)
+{
+  if(ring->head - ring->tail >= ring->hdr->slot_nr)
+  {
+    ring->tail = __atomic_load_n(&(ring->hdr->tail), __ATOMIC_ACQUIRE);
+    if(ring->head - ring->tail >= ring->hdr->slot_nr)
+    {
+      return NULL;
+    }
+  }
+
+  *capacity = ring->hdr->slot_size - sizeof(SHM_RING_SLOT);
+
+  return (uint8_t *) (slot_at(ring, ring->head) + 1);
+}
+
+void shm_ring_commit(SHM_RING *ring, size_t len)
+{
+  SHM_RING_SLOT *slot = slot_at(ring, ring->head);
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  slot->len = (uint32_t) len;
+  slot->stamp_ns = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+
+  ring->head++;
+  __atomic_store_n(&(ring->hdr->head), ring->head, __ATOMIC_RELEASE);
+  ring->pending = 1;
+
+  return;
+}
+
+void shm_ring_drop(SHM_RING *ring)
+{
+  __atomic_fetch_add(&(ring->hdr->dropped), 1, __ATOMIC_RELAXED);
+
+  return;
+}
+
+// signal the commits of a batch; the futex is only entered when a consumer
+// sleeps on it
+void shm_ring_kick(SHM_RING *ring)
+{
+  if(!ring->pending)
+  {
+    return;
+  }
+  ring->pending = 0;
+
+  __atomic_fetch_add(&(ring->hdr->seq), 1, __ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&(ring->hdr->waiters), __ATOMIC_SEQ_CST))
+  {
+    futex(&(ring->hdr->seq), FUTEX_WAKE, 1, NULL);
+  }
+
+  return;
+}
+
+// oldest unread frame of the consumer, read in place; NULL when empty
+const uint8_t *shm_ring_peek(SHM_RING *ring, size_t *len, int64_t *stamp_ns)
+{
+  SHM_RING_SLOT *slot;
+
+  if(ring->tail == ring->head)
+  {
+    ring->head = __atomic_load_n(&(ring->hdr->head), __ATOMIC_ACQUIRE);
+    if(ring->tail == ring->head)
+    {
+      return NULL;
+    }
+  }
+
+  slot = slot_at(ring, ring->tail);
+  *len = slot->len;
+  if(stamp_ns)
+  {
+    *stamp_ns = slot->stamp_ns;
+  }
+
+  return (const uint8_t *) (slot + 1);
+}
+
+void shm_ring_release(SHM_RING *ring)
+{
+  ring->tail++;
+  __atomic_store_n(&(ring->hdr->tail), ring->tail, __ATOMIC_RELEASE);
+
+  return;
+}
+
+// wait until a frame is readable; 0 on data, -1 on timeout or closed ring
+int shm_ring_wait(SHM_RING *ring, int timeout_ms)
+{
+  struct timespec timeout;
+  uint32_t seq;
+  int ready;
+
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (long) (timeout_ms % 1000) * 1000000L;
+
+  __atomic_store_n(&(ring->hdr->waiters), 1, __ATOMIC_SEQ_CST);
+  seq = __atomic_load_n(&(ring->hdr->seq), __ATOMIC_SEQ_CST);
+
+  ready = (__atomic_load_n(&(ring->hdr->head), __ATOMIC_SEQ_CST) != ring->tail);
+  if(!ready && __atomic_load_n(&(ring->hdr->state), __ATOMIC_ACQUIRE))
+  {
+    futex(&(ring->hdr->seq), FUTEX_WAIT, seq, &timeout);
+    ready = (__atomic_load_n(&(ring->hdr->head), __ATOMIC_ACQUIRE) != ring->tail);
+  }
+
+  __atomic_store_n(&(ring->hdr->waiters), 0, __ATOMIC_RELAXED);
+
+  return ready ? 0 : -1;
+}
+
+void shm_ring_close(SHM_RING *ring)
+{
+  if(!ring->active)
+  {
+    return;
+  }
+
+  if(ring->owner)
+  {
+    __atomic_store_n(&(ring->hdr->state), 0, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&(ring->hdr->seq), 1, __ATOMIC_SEQ_CST);
+    futex(&(ring->hdr->seq), FUTEX_WAKE, 1 << 30, NULL);
+    shm_unlink(ring->name);
+  }
+
+  munmap(ring->hdr, ring->size);
+  ring->active = 0;
+
+  return;
+}
@@ -7,8 +7,12 @@
 * global variables
 *******************************************************************************/
 volatile sig_atomic_t stop_process;
+pthread_t main_tid; // receives SIGUSR1 to leave its wait when the run ends
 
-pthread_mutex_t *lock_m;
+pthread_mutex_t lock_m = PTHREAD_MUTEX_INITIALIZER; // shared send socket
+
+pthread_mutex_t lock_conf = PTHREAD_MUTEX_INITIALIZER; // configuration change signal
+pthread_cond_t conf_cv = PTHREAD_COND_INITIALIZER;
 
 // ssi variables
 uint8_t ssi_state;
@@ -21,17 +25,84 @@ uint32_t scan_frame_count;
 uint32_t cont_frame_count;
 
 int s_socket; // shared send socket (needs mutex on write);
+static __thread uint32_t trace_frame; // frame count of the datagram being sent, for the tracepoints
 struct sockaddr_in s_sin;
 
 SSI_CONFIG board_config;
 
+SAMPLE_RING cont_ring; // continuous samples waiting for a datagram
+CONT_BATCH cont_batch; // continuous samples waiting to be generated
+uint64_t cont_sample_count;
+
+int cont_workers = 1;  // continuous payload generation threads
+unsigned int tx_batch_us = TX_BATCH_US;
+WORKER_POOL cont_pool;
+
+// optional PACKET_TX_RING backend of the data streams
+char *raw_ifname = NULL;
+char *raw_dst_mac = NULL;
+const char *raw_src_ip = CLIENT_IP_ADD; // addresses of the built frames, e.g. the ends of a veth pair
+const char *raw_dst_ip = SERVER_IP_ADD;
+
+// optional shared memory rings replacing the data stream sockets
+char *shm_name = NULL;
+
+// zero-copy sends of the TCP server or the io_uring
+int zerocopy = 0;
+
+// optional TCP server streaming the data to connected clients
+int tcp_port = 0;
+int tcp_policy = TCP_POLICY_DROP_OLDEST;
+TCP_STREAM tcp_server;
+
+// optional pcap sink and simulated clock for offline runs
+char *capture_path = NULL;
+CAPTURE capture;
+int64_t virtual_epoch_s = -1;
+
+// optional io_uring driving the data stream sends and the receives
+int use_uring = 0;
+int uring_sqpoll = 0;
+URING uring_tx, uring_rx;
+
+// optional sensor layout correlating the continuous values
+char *layout_path = NULL;
+
+STREAM_TX tx_cont = {.port = PORT_RX_CONT}, tx_scan = {.port = PORT_RX_SCAN};
+
+SCENARIO scenario;
+char *scenario_path = NULL;
+
+DIAG_MODEL diag_model;
+unsigned int diag_period_ms = DIAG_PERIOD_MS; // 0: diagnostic only on request
+int diag_extended = 0;  // append the modeled health fields to the diagnostic frames
+char *diag_params[DIAG_PARAM_NR]; // -P name=value, applied once the model is initialised
+int diag_param_nr = 0;
+
 /*******************************************************************************
 * signal handling
 *******************************************************************************/
+// end of the run: main leaves its wait with EINTR, joins the threads and
+// closes the sinks; pthread_kill is async-signal-safe
+void request_stop()
+{
+  stop_process = 1;
+  pthread_kill(main_tid, SIGUSR1);
+
+  return;
+}
+
+// a second Ctrl-C exits at once if the threads do not stop
 void sigint_handler(int signal) {
+  if(stop_process)
+  {
+    _exit(1);
+  }
   printf("Exiting emulator.\n");
-  stop_process = 1;
-  exit(0);
+  request_stop();
+}
+
+void wake_handler(int signal) {
 }
 
 /*******************************************************************************
@@ -66,16 +137,52 @@ void board_init()
 
   scan_frame_count = 0;
   cont_frame_count = 0;
+  cont_sample_count = 0;
 
   printf("SSI board initalised.\n");
 
   return;
 };
 
+// wake the idle streams when the configuration changes
+void config_changed()
+{
+  TRACE(config_apply, cont_frame_count, 0, 0);
+
+  pthread_mutex_lock(&lock_conf);
+  pthread_cond_broadcast(&conf_cv);
+  pthread_mutex_unlock(&lock_conf);
+  virtual_clock_interrupt();
+
+  return;
+};
+
+// idle wait of a stopped stream, at most one second
+void wait_config_change()
+{
+  struct timespec deadline;
+
+  if(virtual_clock.enabled)
+  {
+    virtual_clock_wait(virtual_clock.now_ns + NSEC_PER_SEC, 1);
+    return;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 1;
+
+  pthread_mutex_lock(&lock_conf);
+  pthread_cond_timedwait(&conf_cv, &lock_conf, &deadline);
+  pthread_mutex_unlock(&lock_conf);
+
+  return;
+};
+
 void update_cont_tx_speed(SSI_CONFIG *conf)
 {
   cont_speed = conf->ssi_cont_speed*scan_time_us;
   printf("Set continuous data speed tx to %d us.\n", cont_speed);
+  config_changed();
 
   return;
 };
@@ -84,6 +191,7 @@ void update_raw_tx_speed(SSI_CONFIG *conf)
 {
   raw_speed = conf->ssi_raw_speed;
   printf("Set scan data speed tx to %d Hertz.\n", raw_speed);
+  config_changed();
 
   return;
 };
@@ -92,6 +200,7 @@ void update_scan_time_us(SSI_CONFIG *conf)
 {
   scan_time_us = conf->ssi_scan_speed;
   printf("Set scan time to %d us.\n", scan_time_us);
+  config_changed();
 
   return;
 };
@@ -222,13 +331,13 @@ int parse_maintenance(uint8_t* buffer, size_t len, SSI_CONFIG *conf)
   int error_code = STATUS_OK;
 
   size_t current_index = 0;
-  int i;
 
   uint8_t cmd, cmd_len, *cmd_data;
   uint8_t upd_scan_speed = 0, upd_cont_speed = 0, upd_scan_time = 0;
 
   HD_MAINTENANCE header;
 
+  TRACE(parse_start, 0, PORT_RX_MAIN, len);
   printf("Parse maintenance message.\n");
 
   if(!buffer) // check buffer pointer
@@ -269,14 +378,17 @@ int parse_maintenance(uint8_t* buffer, size_t len, SSI_CONFIG *conf)
       current_index += read_8((void *) (buffer + current_index), &cmd);
       current_index += read_8((void *) (buffer + current_index), &cmd_len);
 
-      cmd_data = (uint8_t *) malloc(cmd_len * sizeof(uint8_t));
-
-      if(cmd_data)
+      // command data is read in place, no copy
+      if(current_index + cmd_len > len)
       {
-        for(i=0; i<cmd_len; i++)
-        {
-          current_index += read_8((void *) (buffer + current_index), cmd_data + i);
-        }
+        printf("Command length exceeds the message.\n");
+        error_code = STATUS_ERROR;
+      }
+      else
+      {
+        cmd_data = buffer + current_index;
+        current_index += cmd_len;
+
         switch(cmd)
         {
           case CMD_SET_STATE_CMD:
@@ -355,12 +467,6 @@ int parse_maintenance(uint8_t* buffer, size_t len, SSI_CONFIG *conf)
             printf("Command not recognised: %u.\n", cmd);
             break;
         }
-        free(cmd_data);
-      }
-      else
-      {
-        printf("Unable to allocate memory.\n");
-        error_code = STATUS_ERROR;
       }
     }
 
@@ -381,6 +487,8 @@ int parse_maintenance(uint8_t* buffer, size_t len, SSI_CONFIG *conf)
 
     ssi_dump_config(conf);
   }
+
+  TRACE(parse_end, 0, PORT_RX_MAIN, len);
   return error_code;
 };
 
@@ -501,7 +609,7 @@ size_t create_maintenance(uint8_t *message, SSI_CONFIG *conf)
   return current_index;
 };
 
-size_t create_scan(uint8_t *message, size_t len)
+size_t create_scan(uint8_t *message, size_t len, const struct timespec *stamp)
 {
   size_t current_index = 0;
 
@@ -509,10 +617,9 @@ size_t create_scan(uint8_t *message, size_t len)
   uint16_t tmp16 = 0;
   uint32_t tmp32 = 0;
 
-  struct timespec current_time;
-
   int i = 0;
 
+  TRACE(build_start, scan_frame_count, PORT_RX_SCAN, 0);
   printf("Create scan message.\n");
 
   if(!message)
@@ -531,12 +638,11 @@ size_t create_scan(uint8_t *message, size_t len)
     current_index += write_8(&tmp8, message + current_index);
     tmp32 = scan_frame_count++; // ulFrameCount
     current_index += write_32(&tmp32, message + current_index, BE);
-    clock_gettime(CLOCK_REALTIME, &current_time);
-    tmp32 = (uint32_t) current_time.tv_sec; // ulTimeStampH
+    tmp32 = (uint32_t) stamp->tv_sec; // ulTimeStampH
     current_index += write_32(&tmp32, message + current_index, BE);
-    tmp32 = (uint32_t) current_time.tv_nsec/1000; // ulTimeStampL
+    tmp32 = (uint32_t) stamp->tv_nsec/1000; // ulTimeStampL
     current_index += write_32(&tmp32, message + current_index, BE);
-    tmp32 = (uint32_t) current_time.tv_sec; // ulTimeCodeH
+    tmp32 = (uint32_t) stamp->tv_sec; // ulTimeCodeH
     current_index += write_32(&tmp32, message + current_index, BE);
     tmp16 = 400; // usTimeInterval (usecs)
     current_index += write_16(&tmp16, message + current_index, BE);
@@ -556,12 +662,28 @@ size_t create_scan(uint8_t *message, size_t len)
       tmp16 = rand()%51199; // data;
       current_index += write_16(&tmp16, message + current_index, BE);
     }
+
+    trace_frame = scan_frame_count - 1;
   }
 
+  TRACE(build_end, scan_frame_count - 1, PORT_RX_SCAN, current_index);
   return current_index;
 };
 
-size_t create_cont(uint8_t *message, size_t len, SSI_CONFIG *conf)
+// frames per datagram for the given channel format
+int cont_frames_per_msg(uint8_t channels, uint8_t gratings)
+{
+  if(channels == 0 || gratings == 0)
+  {
+    return 0;
+  }
+
+  return (MSG_LIMIT_MTU - HD_CONT_DATA_SIZE)/(gratings*channels*sizeof(uint16_t));
+}
+
+// pack the oldest 'frames' samples of the ring, the header carries the
+// timestamp of the first one and the sample interval of the others
+size_t create_cont(uint8_t *message, size_t len, SAMPLE_RING *ring, size_t frames, uint32_t interval_us)
 {
   size_t current_index = 0;
 
@@ -569,23 +691,31 @@ size_t create_cont(uint8_t *message, size_t len, SSI_CONFIG *conf)
   uint16_t tmp16 = 0;
   uint32_t tmp32 = 0;
 
-  int i, payload_size = 0, frames = 0, channels = 4, gratings = 16;
+  const struct timespec *stamp;
+
+  int channels = 4, gratings = 16;
+  size_t i, payload_size = 0;
 
+  TRACE(build_start, cont_frame_count, PORT_RX_CONT, 0);
   printf("Create continuous message.\n");
 
   if(!message)
   {
     printf("Message pointer is NULL.\n");
   }
+  else if(frames == 0 || frames > sample_ring_count(ring))
+  {
+    printf("Not enough samples to create the message.\n");
+  }
   else
   {
     memset((void *) message, 0, len);
 
-    channels = conf->ssi_channels;
-    gratings = conf->ssi_gratings;
+    channels = ring->channels;
+    gratings = ring->gratings;
 
-    frames = (MSG_LIMIT_MTU - HD_CONT_DATA_SIZE)/(gratings*channels*sizeof(uint16_t));
-    payload_size = frames * (gratings * channels * sizeof(uint16_t));
+    payload_size = frames * ring->sample_size;
+    stamp = sample_ring_stamp(ring, 0);
 
     tmp16 = HD_CONT_DATA_SIZE + payload_size - 2;  // usFrameSize
     current_index += write_16(&tmp16, message + current_index, BE);
@@ -595,13 +725,13 @@ size_t create_cont(uint8_t *message, size_t len, SSI_CONFIG *conf)
     current_index += write_8(&tmp8, message + current_index);
     tmp32 = cont_frame_count++; // ulFrameCount
     current_index += write_32(&tmp32, message + current_index, BE);
-    tmp32 = (uint32_t) time(NULL); // ulTimeStampH
+    tmp32 = (uint32_t) stamp->tv_sec; // ulTimeStampH
     current_index += write_32(&tmp32, message + current_index, BE);
-    tmp32 = rand(); // ulTimeStampL
+    tmp32 = (uint32_t) stamp->tv_nsec/1000; // ulTimeStampL
     current_index += write_32(&tmp32, message + current_index, BE);
-    tmp32 = (uint32_t) time(NULL); // ulTimeCodeH
+    tmp32 = (uint32_t) stamp->tv_sec; // ulTimeCodeH
     current_index += write_32(&tmp32, message + current_index, BE);
-    tmp16 = 400; // usTimeInterval (usecs)
+    tmp16 = (uint16_t) interval_us; // usTimeInterval (usecs)
     current_index += write_16(&tmp16, message + current_index, BE);
     tmp16 = 0; // usSpare
     current_index += write_16(&tmp16, message + current_index, BE);
@@ -614,21 +744,214 @@ size_t create_cont(uint8_t *message, size_t len, SSI_CONFIG *conf)
     tmp32 = 0; // ulSpare
     current_index += write_32(&tmp32, message + current_index, BE);
 
-    for(i=0; i<payload_size; i+=(sizeof(uint16_t)))
+    for(i=0; i<frames; i++)
     {
-      // tmp16 = (rand()%400) * LASER_CHANNEL_MULT; // data;
-      tmp16 = (183 + (rand()%2 == 1 ? 1 : -1)*rand()%50) * LASER_CHANNEL_MULT; // data;
-      current_index += write_16(&tmp16, message + current_index, BE);
+      memcpy(message + current_index, sample_ring_peek(ring, i), ring->sample_size);
+      current_index += ring->sample_size;
     }
+
+    sample_ring_pop(ring, frames);
+    trace_frame = cont_frame_count - 1;
   }
 
+  TRACE(build_end, cont_frame_count - 1, PORT_RX_CONT, current_index);
   return current_index;
 };
 
+// send on the shared socket
+int udp_send(uint8_t *message, size_t msg_len, struct sockaddr_in *dest)
+{
+  int error_code = STATUS_OK;
+  ssize_t sent;
+
+  if(capture.active)
+  {
+    if(capture_write(&capture, ntohs(dest->sin_port), message, msg_len, stream_clock_real_ns()) != 0)
+    {
+      printf("Unable to write capture file.\n");
+      return STATUS_ERROR;
+    }
+    printf("Captured packet of length %ld to port %d.\n", msg_len, ntohs(dest->sin_port));
+    return error_code;
+  }
+
+  TRACE(lock_wait, trace_frame, ntohs(dest->sin_port), msg_len);
+  pthread_mutex_lock(&lock_m);
+  TRACE(lock_acquired, trace_frame, ntohs(dest->sin_port), msg_len);
+  TRACE(send_entry, trace_frame, ntohs(dest->sin_port), msg_len);
+  sent = sendto(s_socket, message, msg_len, 0, (struct sockaddr *) dest, (socklen_t) sizeof(*dest));
+  TRACE(send_return, trace_frame, ntohs(dest->sin_port), sent);
+  if(sent == -1)
+  {
+    printf("Unable to send message.\n");
+    error_code = STATUS_ERROR;
+  }
+  else
+  {
+    printf("Sent packet of length %ld from %s:%d to %s:%d.\n", msg_len, inet_ntoa(s_sin.sin_addr), ntohs(s_sin.sin_port), inet_ntoa(dest->sin_addr), ntohs(dest->sin_port));
+  }
+  pthread_mutex_unlock(&lock_m);
+  TRACE(lock_release, trace_frame, ntohs(dest->sin_port), msg_len);
+
+  return error_code;
+};
+
+// next datagram buffer of a stream: a slot of its shared memory ring or a
+// frame of the TCP, raw TX or io_uring pool when a backend is active, the
+// stream's own buffer otherwise
+uint8_t *stream_tx_buffer(STREAM_TX *tx, uint8_t *message)
+{
+  struct pollfd pfd;
+  uint8_t *frame;
+  size_t capacity = 0;
+
+  if(tx->shm.active)
+  {
+    frame = shm_ring_frame(&(tx->shm), &capacity);
+    return (frame && capacity >= MSG_LIMIT_MTU) ? frame : message;
+  }
+
+  if(tx->tcp)
+  {
+    frame = tcp_stream_frame(tx->tcp, &(tx->tcp_frame), &capacity);
+    return (frame && capacity >= MSG_LIMIT_MTU) ? frame : message;
+  }
+
+  if(tx->uring)
+  {
+    frame = uring_frame(tx->uring, &(tx->uring_frame), &capacity);
+    return (frame && capacity >= MSG_LIMIT_MTU) ? frame : message;
+  }
+
+  if(!tx->raw.active)
+  {
+    return message;
+  }
+
+  // ring full: kick and wait for one frame, the frame is dropped if the
+  // kernel does not free one so the stream never mixes the two paths
+  if((frame = raw_tx_frame(&(tx->raw), &capacity)) == NULL)
+  {
+    raw_tx_kick(&(tx->raw));
+    pfd.fd = tx->raw.fd;
+    pfd.events = POLLOUT;
+    poll(&pfd, 1, TX_FULL_WAIT_MS);
+    frame = raw_tx_frame(&(tx->raw), &capacity);
+  }
+
+  return (frame && capacity >= MSG_LIMIT_MTU) ? frame : message;
+};
+
+int stream_tx_send(STREAM_TX *tx, uint8_t *buffer, uint8_t *message, size_t msg_len, struct sockaddr_in *dest)
+{
+  int error_code = STATUS_OK;
+
+  if(tx->shm.active)
+  {
+    if(buffer != message) // built in place in the shared memory ring
+    {
+      shm_ring_commit(&(tx->shm), msg_len);
+      printf("Queued frame of length %ld on %s.\n", msg_len, tx->shm.name);
+    }
+    else // the reader is a full ring behind
+    {
+      shm_ring_drop(&(tx->shm));
+      printf("Shared memory ring %s full, frame dropped.\n", tx->shm.name);
+      error_code = STATUS_ERROR;
+    }
+    return error_code;
+  }
+
+  if(tx->tcp)
+  {
+    if(buffer != message) // built in place in a pool frame
+    {
+      tcp_stream_commit(tx->tcp, tx->tcp_frame, tx->port, msg_len);
+      printf("Queued frame of length %ld to %d TCP clients.\n", msg_len, tx->tcp->client_nr);
+    }
+    else // no client connected or pool held by slow clients
+    {
+      tcp_stream_drop(tx->tcp);
+      error_code = STATUS_ERROR;
+    }
+    return error_code;
+  }
+
+  if(tx->uring)
+  {
+    if(buffer != message) // built in place in a pool frame, reported at close
+    {
+      uring_send(tx->uring, tx->uring_frame, s_socket, msg_len, dest);
+    }
+    else // the ring failed, the next kick falls back to the socket path
+    {
+      printf("io_uring pool unavailable, frame dropped.\n");
+      error_code = STATUS_ERROR;
+    }
+    return error_code;
+  }
+
+  if(tx->raw.active)
+  {
+    if(buffer != message) // built in place in the TX ring
+    {
+      raw_tx_commit(&(tx->raw), tx->raw_dest, msg_len);
+      printf("Queued packet of length %ld to %s:%d.\n", msg_len, raw_dst_ip, ntohs(dest->sin_port));
+    }
+    else // the kernel is a full ring behind
+    {
+      printf("Raw TX ring full, frame dropped.\n");
+      error_code = STATUS_ERROR;
+    }
+    return error_code;
+  }
+
+  return udp_send(message, msg_len, dest);
+};
+
+// hand the queued frames of a batch to the kernel, or wake the shared
+// memory reader or the TCP server; on raw TX or io_uring failure the
+// stream goes back to the socket path
+void stream_tx_kick(STREAM_TX *tx)
+{
+  if(tx->shm.active)
+  {
+    shm_ring_kick(&(tx->shm));
+  }
+  else if(tx->tcp)
+  {
+    tcp_stream_kick(tx->tcp);
+  }
+  else if(tx->raw.active && raw_tx_kick(&(tx->raw)) != 0)
+  {
+    printf("Raw TX failed, falling back to socket path.\n");
+    raw_tx_close(&(tx->raw));
+  }
+  else if(tx->uring && uring_kick(tx->uring) != 0)
+  {
+    printf("io_uring TX failed, falling back to socket path.\n");
+    tx->uring = NULL;
+  }
+
+  return;
+};
+
+// the backend hands frames to the kernel in batches, the stream threads
+// then wake once per tx_batch_us instead of once per frame
+int stream_tx_batched(STREAM_TX *tx)
+{
+  return (tx->raw.active || tx->uring) && tx_batch_us > 0;
+};
+
 void *scan_th(void *args)
 {
   uint8_t message[MSG_LIMIT_MTU] = {0};
+  uint8_t *buffer;
   size_t msg_len = 0;
+  uint64_t batch;
+
+  STREAM_CLOCK clk = {0};
+  struct timespec stamp;
 
   struct sockaddr_in dest;
 
@@ -641,38 +964,79 @@ void *scan_th(void *args)
     exit(1);
   }
 
+  virtual_clock_attach(VCLOCK_SCAN);
+
   while(!stop_process)
   {
     if(raw_speed != 0)
     {
-      if((msg_len = create_scan(message, MSG_LIMIT_MTU)) > 0)
+      stream_clock_set_period(&clk, 1000000 / raw_speed);
+      stream_clock_refresh(&clk);
+
+      // every scan whose instant has been reached, handed over with one kick
+      do
       {
-        pthread_mutex_lock(lock_m);
-        if((sendto(s_socket, message, msg_len, 0, (struct sockaddr *) &dest, (socklen_t) sizeof(dest))) == -1)
+        stream_clock_stamp(&clk, clk.index, &stamp);
+        buffer = stream_tx_buffer(&tx_scan, message);
+        if((msg_len = create_scan(buffer, MSG_LIMIT_MTU, &stamp)) > 0)
         {
-          printf("Unable to send message.\n");
+          stream_tx_send(&tx_scan, buffer, message, msg_len, &dest);
         }
-        else
-        {
-          printf("Sent packet of length %ld from %s:%d to %s:%d.\n", sizeof(buffer_scan), inet_ntoa(s_sin.sin_addr), ntohs(s_sin.sin_port), inet_ntoa(dest.sin_addr), ntohs(dest.sin_port));
-        }
-        pthread_mutex_unlock(lock_m);
+        clk.index++;
+      } while(stream_clock_deadline(&clk, clk.index) <= clk.now_ns);
+      stream_tx_kick(&tx_scan);
 
+      // wake up for the next scan, or for the last scan of the next batch
+      batch = 1;
+      if(stream_tx_batched(&tx_scan) && tx_batch_us > clk.period_us)
+      {
+        batch = tx_batch_us / clk.period_us;
       }
-      usleep(1000000 / raw_speed);
+      stream_clock_wait_until(&clk, stream_clock_deadline(&clk, clk.index + batch - 1));
     }
     else
     {
-      sleep(1);
+      stream_clock_stop(&clk);
+      wait_config_change();
     }
   }
+  virtual_clock_detach();
   return (void *)0;
 };
 
-void *cont_th(void *args)
+int send_cont(SAMPLE_RING *ring, size_t frames, uint32_t interval_us, struct sockaddr_in *dest)
 {
-  uint8_t message[MSG_LIMIT_MTU] = {0};
+  uint8_t message[MSG_LIMIT_MTU];
+  uint8_t *buffer = stream_tx_buffer(&tx_cont, message);
   size_t msg_len = 0;
+  int error_code = STATUS_OK;
+
+  if((msg_len = create_cont(buffer, MSG_LIMIT_MTU, ring, frames, interval_us)) > 0)
+  {
+    error_code = stream_tx_send(&tx_cont, buffer, message, msg_len, dest);
+  }
+  else
+  {
+    error_code = STATUS_ERROR;
+  }
+
+  return error_code;
+};
+
+// One continuous sample is generated per scan period into the ring; a
+// datagram is flushed as soon as it is full, or when its oldest sample has
+// waited cont_speed us (the continuous rate bounds the latency, not the
+// sample rate).
+void *cont_th(void *args)
+{
+  SAMPLE_RING *ring = &cont_ring;
+  CONT_BATCH *batch = &cont_batch;
+  WORKER_POOL *pool = (cont_workers > 1 ? &cont_pool : NULL);
+  size_t frames = 0, wake;
+  int64_t next_ns, oldest_ns;
+
+  STREAM_CLOCK clk = {0};
+  struct timespec stamp;
 
   struct sockaddr_in dest;
 
@@ -685,46 +1049,431 @@ void *cont_th(void *args)
     exit(1);
   }
 
+  virtual_clock_attach(VCLOCK_CONT);
+
+  sample_ring_reset(ring, board_config.ssi_channels, board_config.ssi_gratings);
+
   while(!stop_process)
   {
-    if(cont_speed != 0)
+    if(cont_speed != 0 && scan_time_us != 0)
     {
-      if((msg_len = create_cont(message, MSG_LIMIT_MTU, &board_config)) > 0)
+      // a new channel format invalidates the pending samples: send them first
+      if(ring->channels != board_config.ssi_channels || ring->gratings != board_config.ssi_gratings)
       {
-        pthread_mutex_lock(lock_m);
-        if((sendto(s_socket, message, msg_len, 0, (struct sockaddr *) &dest, (socklen_t) sizeof(dest))) == -1)
+        if(sample_ring_count(ring) > 0)
         {
-          printf("Unable to send message.\n");
+          send_cont(ring, sample_ring_count(ring), clk.period_us, &dest);
         }
-        else
+        sample_ring_reset(ring, board_config.ssi_channels, board_config.ssi_gratings);
+      }
+
+      frames = cont_frames_per_msg(ring->channels, ring->gratings);
+      if(frames == 0)
+      {
+        wait_config_change();
+        continue;
+      }
+      if(frames > ring->capacity)
+      {
+        frames = ring->capacity;
+      }
+
+      stream_clock_set_period(&clk, scan_time_us);
+      stream_clock_refresh(&clk);
+
+      // reserve every sample whose instant has been reached, generate them
+      // in one batch (sharded over the pool when enabled) and send in order
+      batch->channels = ring->channels;
+      batch->gratings = ring->gratings;
+      while(stream_clock_deadline(&clk, clk.index) <= clk.now_ns)
+      {
+        if(sample_ring_count(ring) >= ring->capacity)
         {
-          printf("Sent packet of length %ld from %s:%d to %s:%d.\n", msg_len, inet_ntoa(s_sin.sin_addr), ntohs(s_sin.sin_port), inet_ntoa(dest.sin_addr), ntohs(dest.sin_port));
+          generate_cont_batch(batch, pool);
+          while(sample_ring_count(ring) >= frames)
+          {
+            send_cont(ring, frames, clk.period_us, &dest);
+          }
         }
-        pthread_mutex_unlock(lock_m);
+
+        stream_clock_stamp(&clk, clk.index, &stamp);
+        batch->slot[batch->count] = sample_ring_push(ring, &stamp, stream_clock_deadline(&clk, clk.index));
+        batch->id[batch->count] = cont_sample_count++;
+        batch->count++;
+        clk.index++;
+      }
+      generate_cont_batch(batch, pool);
+
+      while(sample_ring_count(ring) >= frames)
+      {
+        send_cont(ring, frames, clk.period_us, &dest);
+      }
+
+      if(sample_ring_count(ring) > 0 && clk.now_ns - sample_ring_deadline(ring, 0) >= (int64_t) cont_speed * NSEC_PER_USEC)
+      {
+        send_cont(ring, sample_ring_count(ring), clk.period_us, &dest);
       }
-      usleep(cont_speed);
+
+      stream_tx_kick(&tx_cont);
+
+      // wake up when the datagram is full or its latency bound expires; with
+      // a batched backend, when the datagrams of tx_batch_us are full
+      wake = frames;
+      if(stream_tx_batched(&tx_cont) && frames * clk.period_us < tx_batch_us)
+      {
+        wake = frames * (tx_batch_us / (frames * clk.period_us));
+        if(wake > ring->capacity)
+        {
+          wake = ring->capacity - ring->capacity % frames;
+        }
+      }
+      next_ns = stream_clock_deadline(&clk, clk.index + (wake - sample_ring_count(ring)) - 1);
+      oldest_ns = (sample_ring_count(ring) > 0 ? sample_ring_deadline(ring, 0) : stream_clock_deadline(&clk, clk.index));
+      if(oldest_ns + (int64_t) cont_speed * NSEC_PER_USEC < next_ns)
+      {
+        next_ns = oldest_ns + (int64_t) cont_speed * NSEC_PER_USEC;
+      }
+      stream_clock_wait_until(&clk, next_ns);
     }
     else
     {
-      sleep(1);
+      if(sample_ring_count(ring) > 0)
+      {
+        send_cont(ring, sample_ring_count(ring), clk.period_us, &dest);
+      }
+      stream_clock_stop(&clk);
+      wait_config_change();
     }
   }
 
   printf("End sequence.\n");
+  virtual_clock_detach();
   return (void *)0;
 };
 
+// Steps the board health model and, unless disabled, sends the diagnostic
+// frame on its own timer; requests received by main get the cached frame.
+void *diag_th(void *args)
+{
+  uint8_t message[DIAG_FRAME_MAX];
+  size_t msg_len = 0;
+  unsigned int period_ms = (diag_period_ms ? diag_period_ms : DIAG_PERIOD_MS);
+
+  STREAM_CLOCK clk = {0};
+
+  struct sockaddr_in dest;
+
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(PORT_RX_DIAG);
+
+  if(inet_aton(SERVER_IP_ADD, &(dest.sin_addr)) == 0)
+  {
+    printf("Invalid destination IP address.\n");
+    exit(1);
+  }
+
+  virtual_clock_attach(VCLOCK_DIAG);
+
+  stream_clock_start(&clk, period_ms * 1000);
+
+  while(!stop_process)
+  {
+    clk.index++;
+    stream_clock_wait(&clk);
+
+    diag_step(&diag_model, period_ms);
+
+    if(diag_period_ms && (msg_len = diag_frame(&diag_model, message, sizeof(message))) > 0)
+    {
+      udp_send(message, msg_len, &dest);
+    }
+  }
+
+  virtual_clock_detach();
+  return (void *)0;
+};
+
+// configuration change requested by the scenario, applied as a
+// maintenance message would
+void apply_scenario_step(uint8_t param, int32_t value)
+{
+  switch(param)
+  {
+    case SCN_CONT_RATE:
+      board_config.ssi_cont_speed = (uint16_t) value;
+      update_cont_tx_speed(&board_config);
+      break;
+    case SCN_SCAN_RATE:
+      board_config.ssi_raw_speed = (uint16_t) value;
+      update_raw_tx_speed(&board_config);
+      break;
+    case SCN_SCAN_TIME:
+      board_config.ssi_scan_speed = (uint16_t) value;
+      update_scan_time_us(&board_config);
+      update_cont_tx_speed(&board_config);
+      break;
+    case SCN_CHANFORMAT:
+      board_config.ssi_channels = (uint8_t) (value >> 8);
+      board_config.ssi_gratings = (uint8_t) (value & 0xff);
+      printf("Set channel format to %ux%u.\n", board_config.ssi_channels, board_config.ssi_gratings);
+      config_changed();
+      break;
+    case SCN_STATE:
+      ssi_state = (uint8_t) value;
+      break;
+    case SCN_DEMO:
+      board_config.ssi_demo = (uint8_t) value;
+      break;
+    case SCN_OPERATIONAL_AFTER:
+    case SCN_FAULT_PPM:
+    case SCN_TEMP_MAX:
+    case SCN_ERROR_HOLD:
+    case SCN_RECOVERY:
+    case SCN_AGING:
+    case SCN_RX_ERROR_PPM: // in range, checked by scenario_load
+      diag_set(&diag_model, scenario_param_name(param), (double) value);
+      break;
+    case SCN_STOP:
+      printf("Scenario finished, exiting emulator.\n");
+      request_stop();
+      break;
+    default:
+      break;
+  }
+
+  return;
+};
+
+void *scenario_th(void *args)
+{
+  virtual_clock_attach(VCLOCK_SCENARIO);
+  scenario_run(&scenario, apply_scenario_step, &stop_process);
+  virtual_clock_detach();
+
+  return (void *)0;
+};
+
+// Replies to the middleware requests go through udp_send like every frame
+// the emulator produces: on the shared socket, or into the capture with -c
+// so that the pcap holds the whole exchange.
+void reply_send(uint8_t *message, size_t msg_len, struct sockaddr_in *dest, uint16_t port)
+{
+  dest->sin_port = htons(port);
+  udp_send(message, msg_len, dest);
+
+  return;
+}
+
+// answer a diagnostic request
+void on_diagnostic(int rec_len, struct sockaddr_in *src, struct sockaddr_in *local, struct sockaddr_in *dest)
+{
+  uint8_t tx_buffer[MSG_LIMIT_MTU];
+  size_t msg_len = 0;
+
+  printf("Received packet of size %d from %s:%d on %s:%d.\n", rec_len, inet_ntoa(src->sin_addr), ntohs(src->sin_port), inet_ntoa(local->sin_addr), ntohs(local->sin_port));
+
+  diag_on_request(&diag_model);
+
+  if((msg_len = diag_frame(&diag_model, tx_buffer, sizeof(tx_buffer))) > 0)
+  {
+    reply_send(tx_buffer, msg_len, dest, PORT_RX_DIAG);
+  }
+
+  return;
+}
+
+// apply a maintenance message and answer with the configuration
+void on_maintenance(uint8_t *rx_buffer, int rec_len, struct sockaddr_in *src, struct sockaddr_in *local, struct sockaddr_in *dest)
+{
+  uint8_t tx_buffer[MSG_LIMIT_MTU];
+  size_t msg_len = 0;
+
+  printf("Received packet of size %d from %s:%d on %s:%d.\n", rec_len, inet_ntoa(src->sin_addr), ntohs(src->sin_port), inet_ntoa(local->sin_addr), ntohs(local->sin_port));
+
+  parse_maintenance(rx_buffer, rec_len, &board_config);
+
+  msg_len = create_maintenance(tx_buffer, &board_config);
+
+  reply_send(tx_buffer, msg_len, dest, PORT_RX_MAIN);
+
+  return;
+}
+
+void usage(const char *name)
+{
+  printf("Usage: %s [-o offset_us] [-d drift_ppm] [-p diag_ms [-E] [-P name=value]] [-s scenario]\n"
+         "       [-x ifname [-m dest_mac] [-a src_ip] [-r dest_ip] [-b batch_us] | -z name | -t port [-Z] [-q policy] | -u [-Q] [-Z] [-b batch_us] | -c file.pcap]\n"
+         "       [-V epoch_s] [-S seed] [-L layout [-w workers]]\n", name);
+  printf("  -o  constant offset added to frame timestamps (us)\n");
+  printf("  -d  drift of the emulated board clock (ppm)\n");
+  printf("  -w  threads generating the correlated values of -L (default 1)\n");
+  printf("  -x  send the data streams through a PACKET_TX_RING on ifname\n");
+  printf("  -m  destination MAC for -x (default: neighbour table)\n");
+  printf("  -a  source IP of the -x frames (default %s)\n", CLIENT_IP_ADD);
+  printf("  -r  destination IP of the -x frames (default %s)\n", SERVER_IP_ADD);
+  printf("  -b  interval at which -x or -u hands the frames of a stream to the kernel, 0 for every wake (us, default %d)\n", TX_BATCH_US);
+  printf("  -p  period of the unsolicited diagnostic frames, 0 to disable (ms)\n");
+  printf("  -E  append the modeled temperature, laser power, error counters and state to the diagnostic frames\n");
+  printf("  -P  health model parameter: operational_after, fault_ppm, temp_max (C), error_hold_ms, recovery_ms,\n"
+         "      aging_ppm_h or rx_error_ppm, repeatable\n");
+  printf("  -s  run the configuration timeline in the scenario file\n");
+  printf("  -z  write the data streams to shared memory rings <name>.cont and <name>.scan\n");
+  printf("  -t  stream the data to TCP clients connecting on port (default %d)\n", TCP_STREAM_PORT);
+  printf("  -Z  send the TCP frames with MSG_ZEROCOPY, the io_uring ones with SEND_ZC on registered buffers\n");
+  printf("  -q  full TCP client queue: drop (oldest frames, default) or disconnect\n");
+  printf("  -u  drive the data stream sends and the message receives with io_uring\n");
+  printf("  -Q  poll the io_uring submissions from a kernel thread (SQPOLL)\n");
+  printf("  -c  write the data and diagnostic frames to a pcap file instead of UDP\n");
+  printf("  -V  run on a virtual clock starting at the given UNIX time, as fast as the sink allows (needs -s with a stop)\n");
+  printf("  -S  seed of the payload and health model (default: current time)\n");
+  printf("  -L  generate spatially correlated continuous values over the sensor layout file\n");
+
+  return;
+}
+
 /*******************************************************************************
 * main program
 *******************************************************************************/
 int main (int argc, char **argv){
 
-  signal(SIGINT, sigint_handler);
+  // no SA_RESTART: the waits of main return EINTR on a stop request
+  struct sigaction sa;
 
-  pthread_t c_tid = -1, s_tid = -1;
-  void *result; // thread exit result
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+  main_tid = pthread_self();
+  sa.sa_handler = sigint_handler;
+  sigaction(SIGINT, &sa, NULL);
+  sa.sa_handler = wake_handler;
+  sigaction(SIGUSR1, &sa, NULL);
+
+  int opt;
+  int seed_set = 0;
+  int sinks;
+
+  while((opt = getopt(argc, argv, "o:d:w:x:m:a:r:b:p:EP:s:z:t:Zq:uQc:V:S:L:h")) != -1)
+  {
+    switch(opt)
+    {
+      case 'o':
+        ts_offset_ns = strtoll(optarg, NULL, 10) * NSEC_PER_USEC;
+        break;
+      case 'd':
+        ts_drift_ppm = strtod(optarg, NULL);
+        break;
+      case 'w':
+        cont_workers = atoi(optarg);
+        break;
+      case 'x':
+        raw_ifname = optarg;
+        break;
+      case 'm':
+        raw_dst_mac = optarg;
+        break;
+      case 'a':
+        raw_src_ip = optarg;
+        break;
+      case 'r':
+        raw_dst_ip = optarg;
+        break;
+      case 'b':
+        tx_batch_us = (unsigned int) atoi(optarg);
+        break;
+      case 'p':
+        diag_period_ms = (unsigned int) atoi(optarg);
+        break;
+      case 'E':
+        diag_extended = 1;
+        break;
+      case 'P':
+        if(diag_param_nr == DIAG_PARAM_NR)
+        {
+          printf("Too many health model parameters.\n");
+          exit(1);
+        }
+        diag_params[diag_param_nr++] = optarg;
+        break;
+      case 's':
+        scenario_path = optarg;
+        break;
+      case 'z':
+        shm_name = optarg;
+        break;
+      case 't':
+        tcp_port = atoi(optarg) > 0 ? atoi(optarg) : TCP_STREAM_PORT;
+        break;
+      case 'Z':
+        zerocopy = 1;
+        break;
+      case 'q':
+        tcp_policy = (strcmp(optarg, "disconnect") == 0 ? TCP_POLICY_DISCONNECT : TCP_POLICY_DROP_OLDEST);
+        break;
+      case 'u':
+        use_uring = 1;
+        break;
+      case 'Q':
+        uring_sqpoll = 1;
+        break;
+      case 'c':
+        capture_path = optarg;
+        break;
+      case 'V':
+        virtual_epoch_s = strtoll(optarg, NULL, 10);
+        break;
+      case 'S':
+        payload_seed = strtoull(optarg, NULL, 10);
+        seed_set = 1;
+        break;
+      case 'L':
+        layout_path = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        exit(opt == 'h' ? 0 : 1);
+    }
+  }
 
-  int rec_diag_msg_cnt = 0;
+  // the data streams go to a single sink, and its options need it
+  sinks = (capture_path != NULL) + (shm_name != NULL) + (tcp_port != 0) + (raw_ifname != NULL) + use_uring;
+  if(sinks > 1)
+  {
+    printf("Only one of -c, -z, -t, -x and -u can be given.\n");
+    exit(1);
+  }
+  if((raw_dst_mac || strcmp(raw_src_ip, CLIENT_IP_ADD) != 0 || strcmp(raw_dst_ip, SERVER_IP_ADD) != 0) && !raw_ifname)
+  {
+    printf("-m, -a and -r need -x.\n");
+    exit(1);
+  }
+  if(tx_batch_us != TX_BATCH_US && !raw_ifname && !use_uring)
+  {
+    printf("-b needs -x or -u.\n");
+    exit(1);
+  }
+  if(tcp_policy != TCP_POLICY_DROP_OLDEST && !tcp_port)
+  {
+    printf("-q needs -t.\n");
+    exit(1);
+  }
+  if(uring_sqpoll && !use_uring)
+  {
+    printf("-Q needs -u.\n");
+    exit(1);
+  }
+  if(zerocopy && !use_uring && !tcp_port)
+  {
+    printf("-Z needs -t or -u.\n");
+    exit(1);
+  }
+  // without a layout a wake's batch never reaches CONT_POOL_MIN_WORK
+  if(cont_workers > 1 && !layout_path)
+  {
+    printf("-w needs -L, plain values are generated inline.\n");
+    exit(1);
+  }
+
+  pthread_t c_tid = -1, s_tid = -1, d_tid = -1, t_tid = -1;
+  void *result; // thread exit result
 
   int d_socket, m_socket;
   struct sockaddr_in d_sin, m_sin, src, dest;
@@ -732,32 +1481,57 @@ int main (int argc, char **argv){
   socklen_t l = sizeof(src);
 
   uint8_t rx_buffer[MSG_LIMIT_MTU];
-  uint8_t tx_buffer[MSG_LIMIT_MTU];
   int rec_len;
+  int rx_fd = -1, rx_frame = -1;
 
-  size_t msg_len = 0;
+  char shm_path[SHM_RING_NAME_LEN];
+  char *value;
+  int i;
 
   struct timeval select_to;
-  select_to.tv_sec = 20;
-  select_to.tv_usec = 0;
 
   fd_set read_fds;
   int fd_ready;
 
   stop_process = 0;
 
-  // init mutex for socket critical section
-  lock_m = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-  if (!lock_m) {
-    printf("Unable to allocate lock mutex.\n");
+  footprint_init();
+
+  board_init();
+
+  if(scenario_path && scenario_load(&scenario, scenario_path) != 0)
+  {
     exit(1);
   }
 
-  pthread_mutex_init(lock_m, NULL);
+  if(!seed_set)
+  {
+    payload_seed = (uint64_t) time(NULL);
+  }
+  srand((unsigned int) payload_seed);
 
-  board_init();
+  if(layout_path && strain_field_load(&strain_field, layout_path) != 0)
+  {
+    exit(1);
+  }
 
-  srand(time(NULL));
+  // every pacing thread attaches before simulated time starts
+  if(virtual_epoch_s >= 0)
+  {
+    if(!scenario_path || !scenario_has_stop(&scenario))
+    {
+      printf("Virtual time needs a scenario (-s) ending with a stop step.\n");
+      exit(1);
+    }
+    virtual_clock_enable(virtual_epoch_s * NSEC_PER_SEC, 4);
+    printf("Running on a virtual clock from %lld s, seed %llu.\n", (long long) virtual_epoch_s, (unsigned long long) payload_seed);
+  }
+
+  if(cont_workers > 1 && worker_pool_init(&cont_pool, cont_workers) != 0)
+  {
+    printf("Unable to start continuous generation pool.\n");
+    exit(1);
+  }
 
   printf("Emulator started.\n");
 
@@ -835,19 +1609,149 @@ int main (int argc, char **argv){
   printf("Open maintenance socket on %s:%d.\n", inet_ntoa(m_sin.sin_addr), ntohs(m_sin.sin_port));
   printf("Open send socket on %s:%d.\n", inet_ntoa(s_sin.sin_addr), ntohs(s_sin.sin_port));
 
-  pthread_create(&s_tid, NULL, scan_th, NULL);
-  pthread_create(&c_tid, NULL, cont_th, NULL);
+  if(capture_path)
+  {
+    if(capture_open(&capture, capture_path, CLIENT_IP_ADD, PORT_TX_CLIENT, SERVER_IP_ADD) != 0)
+    {
+      exit(1);
+    }
+  }
+  else if(shm_name)
+  {
+    snprintf(shm_path, SHM_RING_NAME_LEN, "%s.cont", shm_name);
+    shm_ring_create(&(tx_cont.shm), shm_path, PORT_RX_CONT);
+    snprintf(shm_path, SHM_RING_NAME_LEN, "%s.scan", shm_name);
+    shm_ring_create(&(tx_scan.shm), shm_path, PORT_RX_SCAN);
+
+    if(!tx_cont.shm.active || !tx_scan.shm.active)
+    {
+      printf("Shared memory rings unavailable, using the socket path.\n");
+      shm_ring_close(&(tx_cont.shm));
+      shm_ring_close(&(tx_scan.shm));
+    }
+  }
+  else if(tcp_port)
+  {
+    if(tcp_stream_open(&tcp_server, (uint16_t) tcp_port, zerocopy, tcp_policy) == 0)
+    {
+      tx_cont.tcp = &tcp_server;
+      tx_scan.tcp = &tcp_server;
+    }
+    else
+    {
+      printf("TCP stream server unavailable, using the socket path.\n");
+    }
+  }
+  else if(raw_ifname)
+  {
+    raw_tx_open(&(tx_cont.raw), raw_ifname, raw_src_ip, PORT_TX_CLIENT, raw_dst_mac);
+    raw_tx_open(&(tx_scan.raw), raw_ifname, raw_src_ip, PORT_TX_CLIENT, raw_dst_mac);
+
+    tx_cont.raw_dest = raw_tx_add_dest(&(tx_cont.raw), raw_dst_ip, PORT_RX_CONT);
+    tx_scan.raw_dest = raw_tx_add_dest(&(tx_scan.raw), raw_dst_ip, PORT_RX_SCAN);
+
+    if(tx_cont.raw_dest < 0 || tx_scan.raw_dest < 0)
+    {
+      printf("Raw TX unavailable, using the socket path.\n");
+      raw_tx_close(&(tx_cont.raw));
+      raw_tx_close(&(tx_scan.raw));
+    }
+  }
+  else if(use_uring)
+  {
+    if(uring_open(&uring_tx, uring_sqpoll, zerocopy) == 0)
+    {
+      tx_cont.uring = &uring_tx;
+      tx_scan.uring = &uring_tx;
+    }
+    else
+    {
+      printf("io_uring unavailable, using the socket path.\n");
+    }
+  }
+
+  if(use_uring)
+  {
+    // the timed wait of the main loop needs IORING_FEAT_EXT_ARG
+    if(uring_open(&uring_rx, 0, 0) != 0 || !uring_rx.ext_arg ||
+       uring_recv(&uring_rx, d_socket) != 0 || uring_recv(&uring_rx, m_socket) != 0)
+    {
+      printf("io_uring receive unavailable, using select.\n");
+      uring_close(&uring_rx);
+    }
+  }
+
+  diag_init(&diag_model, &ssi_state, payload_seed, MSG_DIAGNOSTIC_SIZE, diag_extended);
+  for(i=0; i<diag_param_nr; i++)
+  {
+    if((value = strchr(diag_params[i], '=')) == NULL)
+    {
+      printf("Invalid health model parameter %s, expected name=value.\n", diag_params[i]);
+      exit(1);
+    }
+    *value = '\0';
+    if(diag_set(&diag_model, diag_params[i], strtod(value + 1, NULL)) != 0)
+    {
+      exit(1);
+    }
+  }
+
+  footprint_thread_create(&s_tid, scan_th, NULL);
+  footprint_thread_create(&c_tid, cont_th, NULL);
+  footprint_thread_create(&d_tid, diag_th, NULL);
+  if(scenario_path)
+  {
+    footprint_thread_create(&t_tid, scenario_th, NULL);
+  }
+
+  footprint_report("startup");
 
   while(!stop_process)
   {
+    if(uring_rx.active) // one receive posted on each socket, read in place in its frame
+    {
+      rec_len = uring_wait_recv(&uring_rx, RX_TIMEOUT_MS, &rx_fd, &rx_frame, &src);
+      if(rx_frame < 0)
+      {
+        if(rec_len != -ETIME && rec_len != -EINTR)
+        {
+          printf("io_uring receive failed: %s, using select.\n", strerror(-rec_len));
+          uring_close(&uring_rx);
+        }
+        continue;
+      }
+
+      if(rec_len < 0)
+      {
+        printf("Unable to read message.\n");
+      }
+      else if(rx_fd == d_socket)
+      {
+        on_diagnostic(rec_len, &src, &d_sin, &dest);
+      }
+      else
+      {
+        on_maintenance(uring_rx.frame[rx_frame], rec_len, &src, &m_sin, &dest);
+      }
+      uring_release(&uring_rx, rx_frame);
+      uring_recv(&uring_rx, rx_fd);
+      continue;
+    }
+
     FD_ZERO(&read_fds);
     FD_SET(d_socket, &read_fds);
     FD_SET(m_socket, &read_fds);
 
+    select_to.tv_sec = RX_TIMEOUT_MS / 1000; // select consumes the timeout
+    select_to.tv_usec = 0;
     fd_ready = select(FD_SETSIZE, &read_fds, 0, 0, &select_to);
 
     if(fd_ready < 0)
     {
+      if(errno == EINTR)
+      {
+        continue;
+      }
       printf("Select failed.\n");
       exit(1);
     }
@@ -859,29 +1763,7 @@ int main (int argc, char **argv){
       }
       else
       {
-        rec_diag_msg_cnt++;
-
-        printf("Received packet of size %d from %s:%d on %s:%d.\n", rec_len, inet_ntoa(src.sin_addr), ntohs(src.sin_port), inet_ntoa(d_sin.sin_addr), ntohs(d_sin.sin_port));
-
-        if(rec_diag_msg_cnt == 1) // set operational state after 1 diagnostic message
-        {
-          ssi_state = SSI_STATE_OPERATIONAL;
-        }
-
-        if((ssi_create_diagnostic_msg(tx_buffer, MSG_DIAGNOSTIC_SIZE, ssi_state)) == STATUS_OK)
-        {
-          dest.sin_port = htons(PORT_RX_DIAG);
-          pthread_mutex_lock(lock_m);
-          if((sendto(s_socket, tx_buffer, MSG_DIAGNOSTIC_SIZE, 0, (struct sockaddr *) &dest, (socklen_t) sizeof(dest))) == -1)
-          {
-            printf("Unable to send message.\n");
-          }
-          else
-          {
-            printf("Sent packet of length %ld from %s:%d to %s:%d.\n", (size_t) MSG_DIAGNOSTIC_SIZE, inet_ntoa(s_sin.sin_addr), ntohs(s_sin.sin_port), inet_ntoa(dest.sin_addr), ntohs(dest.sin_port));
-          }
-          pthread_mutex_unlock(lock_m);
-        }
+        on_diagnostic(rec_len, &src, &d_sin, &dest);
       }
       FD_CLR(d_socket, &read_fds);
     }
@@ -892,28 +1774,21 @@ int main (int argc, char **argv){
       }
       else
       {
-        printf("Received packet of size %d from %s:%d on %s:%d.\n", rec_len, inet_ntoa(src.sin_addr), ntohs(src.sin_port), inet_ntoa(m_sin.sin_addr), ntohs(m_sin.sin_port));
-
-        parse_maintenance(rx_buffer, rec_len, &board_config);
-
-        msg_len = create_maintenance(tx_buffer, &board_config);
-
-        dest.sin_port = htons(PORT_RX_MAIN);
-        pthread_mutex_lock(lock_m);
-        if((sendto(s_socket, tx_buffer, msg_len, 0, (struct sockaddr *) &dest, (socklen_t) sizeof(dest))) == -1)
-        {
-          printf("Unable to send message.\n");
-        }
-        else
-        {
-          printf("Sent packet of length %ld from %s:%d to %s:%d.\n", (size_t) MSG_DIAGNOSTIC_SIZE, inet_ntoa(s_sin.sin_addr), ntohs(s_sin.sin_port), inet_ntoa(dest.sin_addr), ntohs(dest.sin_port));
-        }
-        pthread_mutex_unlock(lock_m);
+        on_maintenance(rx_buffer, rec_len, &src, &m_sin, &dest);
       }
       FD_CLR(m_socket, &read_fds);
     }
   }
 
+  // the streams may still be sending until they are joined
+  pthread_join(c_tid, &result);
+  pthread_join(s_tid, &result);
+  pthread_join(d_tid, &result);
+  if(scenario_path)
+  {
+    pthread_join(t_tid, &result);
+  }
+
   close(d_socket);
   printf("Closing diagnostic socket.\n");
   close(m_socket);
@@ -921,11 +1796,27 @@ int main (int argc, char **argv){
   close(s_socket);
   printf("Closing send socket.\n");
 
-  pthread_join(c_tid, &result);
-  pthread_join(s_tid, &result);
+  capture_close(&capture);
+  shm_ring_close(&(tx_cont.shm));
+  shm_ring_close(&(tx_scan.shm));
+  if(tcp_server.active)
+  {
+    tcp_stream_close(&tcp_server);
+  }
+  if(raw_ifname)
+  {
+    raw_tx_close(&(tx_cont.raw));
+    raw_tx_close(&(tx_scan.raw));
+  }
+  uring_close(&uring_tx);
+  uring_close(&uring_rx);
+
+  if(cont_workers > 1)
+  {
+    worker_pool_destroy(&cont_pool);
+  }
 
-  pthread_mutex_destroy(lock_m);
-  free(lock_m);
+  strain_field_free(&strain_field);
 
   return 0;
 }
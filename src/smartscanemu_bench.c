@@ -0,0 +1,587 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../include/stream_clock.h"
+#include "../include/cont_payload.h"
+#include "../include/shm_ring.h"
+#include "../include/uring.h"
+
+#include <libsmartscan/smartscan_utils.h>
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define BENCH_CHANNELS 16
+#define BENCH_GRATINGS 16
+#define BENCH_SAMPLES  200000
+
+#define BENCH_FRAMES     200000
+#define BENCH_FRAME_SIZE 1472   // MSG_LIMIT_MTU
+#define BENCH_WINDOW     64     // frames in flight of the throughput run
+#define BENCH_LAT_BINS   32     // log2 buckets in nanoseconds
+#define BENCH_BATCH      16     // frames per kick of a batched stream, e.g. the scans of -b 1000 at 16 kHz
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// one transport run: a producer thread sends frames stamped with
+// CLOCK_MONOTONIC, the consumer measures their latency
+typedef struct {
+  SHM_RING tx;
+  SHM_RING rx;
+  int      tx_fd;
+  int      rx_fd;
+  struct sockaddr_in rx_addr;
+  long     frames;
+  long     window;      // frames in flight, same bound for both paths
+  uint64_t received __attribute__((aligned(64)));
+  uint64_t lat_hist[BENCH_LAT_BINS];
+  int64_t  lat_sum_ns;
+  int64_t  lat_max_ns;
+} BENCH_TRANSPORT;
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static double elapsed_s(const struct timespec *start, const struct timespec *end)
+{
+  return (double) (timespec_to_ns(end) - timespec_to_ns(start)) / NSEC_PER_SEC;
+}
+
+// samples/s generating batches of 'size' samples, as cont_th hands them over
+static double shard_rate(CONT_BATCH *batch, WORKER_POOL *pool, uint8_t *buffer, size_t sample_size, size_t size, long samples)
+{
+  struct timespec start, end;
+  long done;
+  size_t i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(done=0; done<samples; )
+  {
+    for(i=0; i<size && done<samples; i++, done++)
+    {
+      batch->slot[i] = buffer + i * sample_size;
+      batch->id[i] = (uint64_t) done;
+    }
+    batch->count = i;
+    generate_cont_batch(batch, pool);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return samples / elapsed_s(&start, &end);
+}
+
+// continuous payload generation rate for 1..max_workers pool threads, with
+// the batch of a steady-state wake (one datagram of samples) and with the
+// batch of a catch-up after a stall (a full sample ring)
+int bench_shard(int channels, int gratings, long samples, int max_workers)
+{
+  static CONT_BATCH batch;
+  static WORKER_POOL pool[WORKER_POOL_MAX + 1];
+  size_t sample_size = (size_t) channels * gratings * sizeof(uint16_t);
+  size_t size[2], frames;
+  const char *name[2] = {"per wake", "catch-up"};
+  uint8_t *buffer;
+  double rate, base_rate;
+  int w, workers = 0, b;
+
+  if(sample_size == 0 || sample_size > SAMPLE_RING_BYTES)
+  {
+    printf("Invalid format %dx%d.\n", channels, gratings);
+    return -1;
+  }
+
+  frames = (MSG_LIMIT_MTU - HD_CONT_DATA_SIZE) / sample_size;
+  size[0] = frames > 0 ? frames : 1;
+  size[1] = SAMPLE_RING_BYTES / sample_size;
+
+  if((buffer = (uint8_t *) malloc(size[1] * sample_size)) == NULL)
+  {
+    printf("Unable to allocate benchmark buffer.\n");
+    return -1;
+  }
+
+  for(w=2; w<=max_workers; w++, workers++)
+  {
+    if(worker_pool_init(&pool[w], w) != 0)
+    {
+      break;
+    }
+  }
+
+  batch.channels = channels;
+  batch.gratings = gratings;
+
+  printf("Sharded generation, %dx%d format, %ld samples.\n", channels, gratings, samples);
+  for(b=0; b<2; b++)
+  {
+    batch.count = size[b];
+    printf("\n%s: %zu samples per batch, %s\n", name[b], size[b],
+           cont_batch_work(&batch) >= CONT_POOL_MIN_WORK ? "sharded over the pool" : "below CONT_POOL_MIN_WORK, generated inline");
+    printf("%8s %16s %10s %10s\n", "workers", "samples/s", "speedup", "eff.");
+
+    base_rate = shard_rate(&batch, NULL, buffer, sample_size, size[b], samples);
+    printf("%8d %16.0f %10.2f %9.0f%%\n", 1, base_rate, 1.0, 100.0);
+    for(w=2; w<=workers+1; w++)
+    {
+      rate = shard_rate(&batch, &pool[w], buffer, sample_size, size[b], samples);
+      printf("%8d %16.0f %10.2f %9.0f%%\n", w, rate, rate / base_rate, 100.0 * rate / base_rate / w);
+    }
+  }
+
+  for(w=2; w<=workers+1; w++)
+  {
+    worker_pool_destroy(&pool[w]);
+  }
+  free(buffer);
+
+  return 0;
+}
+
+static int64_t mono_ns()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return timespec_to_ns(&now);
+}
+
+static void record_latency(BENCH_TRANSPORT *bt, int64_t lat_ns)
+{
+  int bin = 0;
+
+  while((lat_ns >> (bin + 1)) > 0 && bin < BENCH_LAT_BINS - 1)
+  {
+    bin++;
+  }
+
+  bt->lat_hist[bin]++;
+  bt->lat_sum_ns += lat_ns;
+  if(lat_ns > bt->lat_max_ns)
+  {
+    bt->lat_max_ns = lat_ns;
+  }
+  __atomic_store_n(&(bt->received), bt->received + 1, __ATOMIC_RELEASE);
+
+  return;
+}
+
+// upper bound of the bucket holding the given fraction of the frames
+static double latency_quantile(BENCH_TRANSPORT *bt, double q)
+{
+  uint64_t total = 0, acc = 0;
+  int bin;
+
+  for(bin=0; bin<BENCH_LAT_BINS; bin++)
+  {
+    total += bt->lat_hist[bin];
+  }
+
+  for(bin=0; bin<BENCH_LAT_BINS; bin++)
+  {
+    acc += bt->lat_hist[bin];
+    if(acc >= q * total)
+    {
+      break;
+    }
+  }
+
+  return (double) (1LL << (bin + 1)) / 1000.0;
+}
+
+// hold the producer while window frames are in flight
+static void wait_window(BENCH_TRANSPORT *bt, long sent)
+{
+  while(sent - (long) __atomic_load_n(&(bt->received), __ATOMIC_ACQUIRE) >= bt->window)
+  {
+    sched_yield();
+  }
+
+  return;
+}
+
+void *shm_consumer(void *args)
+{
+  BENCH_TRANSPORT *bt = (BENCH_TRANSPORT *) args;
+  const uint8_t *frame;
+  size_t len;
+  int64_t stamp_ns;
+  long n = 0;
+
+  while(n < bt->frames)
+  {
+    if((frame = shm_ring_peek(&(bt->rx), &len, NULL)) == NULL)
+    {
+      shm_ring_wait(&(bt->rx), 100);
+      continue;
+    }
+    memcpy(&stamp_ns, frame, sizeof(stamp_ns)); // the frame itself is read in place
+    record_latency(bt, mono_ns() - stamp_ns);
+    shm_ring_release(&(bt->rx));
+    n++;
+  }
+
+  return (void *)0;
+}
+
+void *udp_consumer(void *args)
+{
+  BENCH_TRANSPORT *bt = (BENCH_TRANSPORT *) args;
+  uint8_t frame[BENCH_FRAME_SIZE];
+  int64_t stamp_ns;
+  long n = 0;
+
+  while(n < bt->frames)
+  {
+    if(recv(bt->rx_fd, frame, sizeof(frame), 0) < (ssize_t) sizeof(stamp_ns))
+    {
+      break; // receive timeout: datagrams were lost
+    }
+    memcpy(&stamp_ns, frame, sizeof(stamp_ns));
+    record_latency(bt, mono_ns() - stamp_ns);
+    n++;
+  }
+
+  return (void *)0;
+}
+
+static void transport_report(const char *name, BENCH_TRANSPORT *bt, double seconds)
+{
+  printf("%8s %8ld %12.0f %10.1f %10.1f %10.1f %10.1f %10lu\n", name, bt->window, bt->received / seconds,
+         bt->received ? (double) bt->lat_sum_ns / bt->received / 1000.0 : 0.0,
+         latency_quantile(bt, 0.5), latency_quantile(bt, 0.99), bt->lat_max_ns / 1000.0,
+         (unsigned long) (bt->frames - bt->received));
+
+  return;
+}
+
+// frames built in place in the slots of a shared memory ring
+int bench_shm(BENCH_TRANSPORT *bt)
+{
+  char name[SHM_RING_NAME_LEN];
+  struct timespec start, end;
+  pthread_t tid;
+  void *result;
+  uint8_t *frame;
+  size_t capacity;
+  int64_t stamp_ns;
+  long i;
+
+  snprintf(name, sizeof(name), "/smartscanemu_bench.%d", (int) getpid());
+  if(shm_ring_create(&(bt->tx), name, 0) != 0 || shm_ring_attach(&(bt->rx), name) != 0)
+  {
+    shm_ring_close(&(bt->tx));
+    return -1;
+  }
+
+  pthread_create(&tid, NULL, shm_consumer, bt);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0; i<bt->frames; i++)
+  {
+    wait_window(bt, i);
+    while((frame = shm_ring_frame(&(bt->tx), &capacity)) == NULL)
+    {
+      sched_yield();
+    }
+    memset(frame + sizeof(stamp_ns), (int) i, BENCH_FRAME_SIZE - sizeof(stamp_ns));
+    stamp_ns = mono_ns();
+    memcpy(frame, &stamp_ns, sizeof(stamp_ns));
+    shm_ring_commit(&(bt->tx), BENCH_FRAME_SIZE);
+    shm_ring_kick(&(bt->tx));
+  }
+  pthread_join(tid, &result);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  shm_ring_close(&(bt->rx));
+  shm_ring_close(&(bt->tx));
+  transport_report("shm", bt, elapsed_s(&start, &end));
+
+  return 0;
+}
+
+// UDP on loopback, the path the data streams take by default
+int bench_udp(BENCH_TRANSPORT *bt)
+{
+  uint8_t message[BENCH_FRAME_SIZE];
+  struct timespec start, end;
+  struct timeval rx_to = {1, 0};
+  socklen_t addr_len = sizeof(bt->rx_addr);
+  pthread_t tid;
+  void *result;
+  int64_t stamp_ns;
+  long i;
+
+  bt->rx_addr.sin_family = AF_INET;
+  bt->rx_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if((bt->rx_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 || (bt->tx_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ||
+     bind(bt->rx_fd, (struct sockaddr *) &(bt->rx_addr), sizeof(bt->rx_addr)) == -1 ||
+     getsockname(bt->rx_fd, (struct sockaddr *) &(bt->rx_addr), &addr_len) == -1)
+  {
+    printf("Unable to open loopback sockets.\n");
+    return -1;
+  }
+  setsockopt(bt->rx_fd, SOL_SOCKET, SO_RCVTIMEO, &rx_to, sizeof(rx_to));
+
+  pthread_create(&tid, NULL, udp_consumer, bt);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0; i<bt->frames; i++)
+  {
+    wait_window(bt, i);
+    memset(message + sizeof(stamp_ns), (int) i, BENCH_FRAME_SIZE - sizeof(stamp_ns));
+    stamp_ns = mono_ns();
+    memcpy(message, &stamp_ns, sizeof(stamp_ns));
+    if(sendto(bt->tx_fd, message, BENCH_FRAME_SIZE, 0, (struct sockaddr *) &(bt->rx_addr), sizeof(bt->rx_addr)) == -1)
+    {
+      break;
+    }
+  }
+  pthread_join(tid, &result);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  close(bt->tx_fd);
+  close(bt->rx_fd);
+  transport_report("udp", bt, elapsed_s(&start, &end));
+
+  return 0;
+}
+
+// frames of BENCH_FRAME_SIZE through a shared memory ring and through UDP
+// on loopback: one frame in flight for latency, BENCH_WINDOW for throughput
+int bench_transport(long frames)
+{
+  static BENCH_TRANSPORT bt;
+  long window[2] = {1, BENCH_WINDOW};
+  int w;
+
+  printf("Transport of %ld frames of %d bytes.\n", frames, BENCH_FRAME_SIZE);
+  printf("%8s %8s %12s %10s %10s %10s %10s %10s\n", "path", "window", "frames/s", "avg us", "p50 us", "p99 us", "max us", "lost");
+
+  for(w=0; w<2; w++)
+  {
+    memset(&bt, 0, sizeof(bt));
+    bt.frames = frames;
+    bt.window = window[w];
+    if(bench_shm(&bt) != 0)
+    {
+      return -1;
+    }
+
+    memset(&bt, 0, sizeof(bt));
+    bt.frames = frames;
+    bt.window = window[w];
+    if(bench_udp(&bt) != 0)
+    {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static double cpu_s()
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru); // includes the SQPOLL kernel thread of the process
+
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// Send frames of BENCH_FRAME_SIZE to a loopback socket nobody reads, with
+// one sendto per frame (mode 0) or through an io_uring kicked every batch
+// frames. System calls are the ones issued by the sender.
+int bench_send_run(const char *name, int mode, int sqpoll, int zerocopy, int batch, long frames, int fd, struct sockaddr_in *dest)
+{
+  char label[32];
+  static URING ring;
+  struct timespec start, end;
+  uint8_t message[BENCH_FRAME_SIZE] = {0};
+  uint8_t *data;
+  size_t capacity;
+  double cpu_start, cpu_end;
+  uint64_t syscalls = 0;
+  long i;
+  int frame, k;
+
+  if(mode && uring_open(&ring, sqpoll, zerocopy) != 0)
+  {
+    return -1;
+  }
+  if(mode && zerocopy && !ring.zerocopy)
+  {
+    uring_close(&ring);
+    return 0;
+  }
+
+  cpu_start = cpu_s();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0; i<frames; i++)
+  {
+    if(!mode)
+    {
+      memcpy(message, &i, sizeof(i));
+      sendto(fd, message, BENCH_FRAME_SIZE, 0, (struct sockaddr *) dest, sizeof(*dest));
+      syscalls++;
+      continue;
+    }
+
+    if((data = uring_frame(&ring, &frame, &capacity)) == NULL)
+    {
+      break;
+    }
+    memcpy(data, &i, sizeof(i));
+    uring_send(&ring, frame, fd, BENCH_FRAME_SIZE, dest);
+    if((i + 1) % batch == 0 || i + 1 == frames)
+    {
+      uring_kick(&ring);
+    }
+  }
+  if(mode) // every frame back in the pool: all the sends completed
+  {
+    for(k=0; k<URING_FRAMES; k++)
+    {
+      uring_frame(&ring, &frame, &capacity);
+    }
+    syscalls = ring.enters;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  cpu_end = cpu_s();
+
+  if(mode)
+  {
+    uring_close(&ring);
+  }
+
+  snprintf(label, sizeof(label), mode ? "%s /%d" : "%s", name, batch);
+  printf("%-20s %12.0f %14.3f %14.2f\n", label, frames / elapsed_s(&start, &end),
+         (double) syscalls / frames, 1e6 * (cpu_end - cpu_start) / frames);
+
+  return 0;
+}
+
+// System calls and CPU per frame of the socket path and the io_uring modes,
+// kicked after every frame as a stream does when each wake has a single
+// datagram (-b 0, or a scan period longer than -b) and every BENCH_BATCH
+// frames as a batched stream at a high rate.
+int bench_send(long frames)
+{
+  static const int batch[2] = {1, BENCH_BATCH};
+  struct sockaddr_in dest = {0};
+  socklen_t addr_len = sizeof(dest);
+  int rx_fd, tx_fd, b;
+
+  dest.sin_family = AF_INET;
+  dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if((rx_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 || (tx_fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ||
+     bind(rx_fd, (struct sockaddr *) &dest, sizeof(dest)) == -1 || getsockname(rx_fd, (struct sockaddr *) &dest, &addr_len) == -1)
+  {
+    printf("Unable to open loopback sockets.\n");
+    return -1;
+  }
+
+  printf("Send backends, %ld frames of %d bytes, io_uring kicked every /n frames.\n", frames, BENCH_FRAME_SIZE);
+  printf("%-20s %12s %14s %14s\n", "backend", "frames/s", "syscalls/frame", "cpu us/frame");
+
+  bench_send_run("sendto", 0, 0, 0, 1, frames, tx_fd, &dest);
+  for(b=0; b<2; b++)
+  {
+    bench_send_run("uring", 1, 0, 0, batch[b], frames, tx_fd, &dest);
+    bench_send_run("uring zc", 1, 0, 1, batch[b], frames, tx_fd, &dest);
+    bench_send_run("uring sqpoll", 1, 1, 0, batch[b], frames, tx_fd, &dest);
+    bench_send_run("uring sqpoll zc", 1, 1, 1, batch[b], frames, tx_fd, &dest);
+  }
+
+  close(tx_fd);
+  close(rx_fd);
+
+  return 0;
+}
+
+void usage(const char *name)
+{
+  printf("Usage: %s [-c channels] [-g gratings] [-n samples] [-w max_workers] [-l layout] [-t frames] [-u frames]\n", name);
+  printf("  -l  generate correlated values over the sensor layout file\n");
+  printf("  -u  compare sendto with the io_uring send modes instead\n");
+  printf("  -t  compare the shared memory ring with UDP on loopback instead\n");
+
+  return;
+}
+
+/*******************************************************************************
+* main program
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+  int channels = BENCH_CHANNELS, gratings = BENCH_GRATINGS;
+  long samples = BENCH_SAMPLES;
+  int max_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  long transport_frames = 0, send_frames = 0;
+  char *layout_path = NULL;
+  int opt;
+
+  while((opt = getopt(argc, argv, "c:g:n:w:l:t:u:h")) != -1)
+  {
+    switch(opt)
+    {
+      case 'c':
+        channels = atoi(optarg);
+        break;
+      case 'g':
+        gratings = atoi(optarg);
+        break;
+      case 'n':
+        samples = atol(optarg);
+        break;
+      case 'w':
+        max_workers = atoi(optarg);
+        break;
+      case 'u':
+        send_frames = atol(optarg) > 0 ? atol(optarg) : BENCH_FRAMES;
+        break;
+      case 'l':
+        layout_path = optarg;
+        break;
+      case 't':
+        transport_frames = atol(optarg) > 0 ? atol(optarg) : BENCH_FRAMES;
+        break;
+      default:
+        usage(argv[0]);
+        exit(opt == 'h' ? 0 : 1);
+    }
+  }
+
+  if(max_workers > WORKER_POOL_MAX)
+  {
+    max_workers = WORKER_POOL_MAX;
+  }
+
+  if(transport_frames > 0)
+  {
+    return bench_transport(transport_frames) == 0 ? 0 : 1;
+  }
+
+  if(send_frames > 0)
+  {
+    return bench_send(send_frames) == 0 ? 0 : 1;
+  }
+
+  if(layout_path && strain_field_load(&strain_field, layout_path) != 0)
+  {
+    return 1;
+  }
+
+  return bench_shard(channels, gratings, samples, max_workers) == 0 ? 0 : 1;
+}
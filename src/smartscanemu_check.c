@@ -0,0 +1,457 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/smartscanemu_check.h"
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+volatile sig_atomic_t stop_process;
+
+static const char *stream_name[CHECK_STREAMS] = {"cont", "scan", "diag", "main"};
+static const uint16_t stream_port[CHECK_STREAMS] = {PORT_RX_CONT, PORT_RX_SCAN, PORT_RX_DIAG, PORT_RX_MAIN};
+
+int r_socket[CHECK_STREAMS];
+
+CHECK_PIPE pipe_rx;
+CHECK_STATS stats[CHECK_STREAMS];
+pthread_mutex_t lock_stats = PTHREAD_MUTEX_INITIALIZER; // stats thread vs report
+
+/*******************************************************************************
+* signal handling
+*******************************************************************************/
+void sigint_handler(int signal) {
+  stop_process = 1;
+}
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static int hist_bin(int64_t us)
+{
+  int bin = 0;
+
+  while(us > 1 && bin < CHECK_HIST_BINS - 1)
+  {
+    us >>= 1;
+    bin++;
+  }
+
+  return bin;
+}
+
+// header layout shared by create_cont() and create_scan()
+void decode_frame(uint8_t *buffer, size_t len, CHECK_RECORD *rec)
+{
+  uint16_t frame_size, steps;
+  uint8_t hdr_size, format;
+  uint32_t stamp_h, stamp_l;
+  size_t payload, frame_bytes;
+  int channels, gratings;
+
+  if(len < CHECK_HDR_SIZE)
+  {
+    rec->errors |= CHECK_ERR_SHORT;
+    return;
+  }
+
+  read_16(buffer + 0, &frame_size, BE);
+  read_8(buffer + 2, &hdr_size);
+  read_8(buffer + 3, &format);
+  read_32(buffer + 4, &(rec->counter), BE);
+  read_32(buffer + 8, &stamp_h, BE);
+  read_32(buffer + 12, &stamp_l, BE);
+  read_16(buffer + 20, &(rec->interval_us), BE);
+  read_16(buffer + 22, &steps, BE);
+
+  rec->stamp_ns = (int64_t) stamp_h * NSEC_PER_SEC + (int64_t) stamp_l * NSEC_PER_USEC;
+
+  if(frame_size != len - 2)
+  {
+    rec->errors |= CHECK_ERR_SIZE;
+  }
+  if(hdr_size * 4 != CHECK_HDR_SIZE)
+  {
+    rec->errors |= CHECK_ERR_HDR;
+  }
+
+  payload = len - CHECK_HDR_SIZE;
+
+  if(rec->stream == CHECK_STREAM_CONT)
+  {
+    gratings = (format >> 4) & 0x0f;
+    gratings = (gratings == 0 ? 16 : gratings);
+    channels = format & 0x0f;
+    frame_bytes = (size_t) gratings * channels * sizeof(uint16_t);
+
+    if(frame_bytes == 0 || payload % frame_bytes != 0)
+    {
+      rec->errors |= CHECK_ERR_PAYLOAD;
+    }
+    else
+    {
+      rec->samples = (uint16_t) (payload / frame_bytes);
+    }
+  }
+  else
+  {
+    if(payload != (size_t) steps * sizeof(uint16_t))
+    {
+      rec->errors |= CHECK_ERR_PAYLOAD;
+    }
+    rec->samples = steps;
+  }
+
+  return;
+}
+
+static void pipe_push(CHECK_PIPE *p, const CHECK_RECORD *rec)
+{
+  uint64_t head = p->head;
+
+  if(head - __atomic_load_n(&(p->tail), __ATOMIC_ACQUIRE) >= CHECK_PIPE_SIZE)
+  {
+    p->dropped++;
+    return;
+  }
+
+  p->rec[head % CHECK_PIPE_SIZE] = *rec;
+  __atomic_store_n(&(p->head), head + 1, __ATOMIC_RELEASE);
+
+  return;
+}
+
+// receive every socket with recvmmsg, decode and forward to the stats thread
+void *rx_th(void *args)
+{
+  static uint8_t buffers[CHECK_BATCH][MSG_LIMIT_MTU + 1];
+  static uint8_t controls[CHECK_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+  struct mmsghdr msgs[CHECK_BATCH];
+  struct iovec iov[CHECK_BATCH];
+  struct pollfd pfd[CHECK_STREAMS];
+  struct timespec now;
+  struct cmsghdr *cmsg;
+  CHECK_RECORD rec;
+  int i, j, n;
+
+  for(i=0; i<CHECK_STREAMS; i++)
+  {
+    pfd[i].fd = r_socket[i];
+    pfd[i].events = POLLIN;
+  }
+
+  while(!stop_process)
+  {
+    if(poll(pfd, CHECK_STREAMS, 200) <= 0)
+    {
+      continue;
+    }
+
+    for(i=0; i<CHECK_STREAMS; i++)
+    {
+      if(!(pfd[i].revents & POLLIN))
+      {
+        continue;
+      }
+
+      for(j=0; j<CHECK_BATCH; j++)
+      {
+        iov[j].iov_base = buffers[j];
+        iov[j].iov_len = sizeof(buffers[j]);
+        memset(&(msgs[j]), 0, sizeof(msgs[j]));
+        msgs[j].msg_hdr.msg_iov = &(iov[j]);
+        msgs[j].msg_hdr.msg_iovlen = 1;
+        msgs[j].msg_hdr.msg_control = controls[j];
+        msgs[j].msg_hdr.msg_controllen = sizeof(controls[j]);
+      }
+
+      if((n = recvmmsg(r_socket[i], msgs, CHECK_BATCH, MSG_DONTWAIT, NULL)) <= 0)
+      {
+        continue;
+      }
+
+      clock_gettime(CLOCK_REALTIME, &now);
+
+      for(j=0; j<n; j++)
+      {
+        memset(&rec, 0, sizeof(rec));
+        rec.stream = (uint8_t) i;
+        rec.len = (uint16_t) msgs[j].msg_len;
+        rec.arrival_ns = timespec_to_ns(&now);
+
+        for(cmsg = CMSG_FIRSTHDR(&(msgs[j].msg_hdr)); cmsg; cmsg = CMSG_NXTHDR(&(msgs[j].msg_hdr), cmsg))
+        {
+          if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+          {
+            rec.arrival_ns = timespec_to_ns((struct timespec *) CMSG_DATA(cmsg));
+          }
+        }
+
+        if(i == CHECK_STREAM_CONT || i == CHECK_STREAM_SCAN)
+        {
+          decode_frame(buffers[j], msgs[j].msg_len, &rec);
+        }
+
+        pipe_push(&pipe_rx, &rec);
+      }
+    }
+  }
+
+  return (void *)0;
+}
+
+void account(CHECK_STATS *st, const CHECK_RECORD *rec)
+{
+  int64_t lat_us, iat_us;
+  uint32_t expected;
+
+  st->packets++;
+  st->bytes += rec->len;
+  st->samples += rec->samples;
+
+  if(rec->errors)
+  {
+    st->errors++;
+  }
+
+  if(st->have_last)
+  {
+    iat_us = (rec->arrival_ns - st->last_arrival_ns) / NSEC_PER_USEC;
+    st->iat_hist[hist_bin(iat_us)]++;
+  }
+  else
+  {
+    st->first_arrival_ns = rec->arrival_ns;
+  }
+
+  // a short frame has no counter nor stamp, a late one leaves the sequence
+  // where it was so the next in-order frame is not counted as a gap
+  if((rec->stream == CHECK_STREAM_CONT || rec->stream == CHECK_STREAM_SCAN) && !(rec->errors & CHECK_ERR_SHORT))
+  {
+    expected = st->last_counter + 1;
+    if(!st->have_counter || rec->counter == expected)
+    {
+      st->last_counter = rec->counter;
+    }
+    else if((int32_t) (rec->counter - expected) > 0)
+    {
+      st->gaps += rec->counter - expected;
+      st->last_counter = rec->counter;
+    }
+    else
+    {
+      st->reordered++;
+    }
+    st->have_counter = 1;
+
+    lat_us = (rec->arrival_ns - rec->stamp_ns) / NSEC_PER_USEC;
+    st->lat_samples++;
+    if(st->lat_samples == 1 || lat_us < st->lat_min_us)
+    {
+      st->lat_min_us = lat_us;
+    }
+    if(st->lat_samples == 1 || lat_us > st->lat_max_us)
+    {
+      st->lat_max_us = lat_us;
+    }
+    st->lat_sum_us += (double) lat_us;
+    st->lat_hist[hist_bin(lat_us < 0 ? 0 : lat_us)]++;
+  }
+
+  st->have_last = 1;
+  st->last_arrival_ns = rec->arrival_ns;
+
+  return;
+}
+
+void *stats_th(void *args)
+{
+  CHECK_PIPE *p = &pipe_rx;
+  uint64_t tail, head;
+
+  while(!stop_process)
+  {
+    tail = p->tail;
+    head = __atomic_load_n(&(p->head), __ATOMIC_ACQUIRE);
+
+    if(tail == head)
+    {
+      usleep(1000);
+      continue;
+    }
+
+    pthread_mutex_lock(&lock_stats);
+    for(; tail != head; tail++)
+    {
+      account(&(stats[p->rec[tail % CHECK_PIPE_SIZE].stream]), &(p->rec[tail % CHECK_PIPE_SIZE]));
+    }
+    pthread_mutex_unlock(&lock_stats);
+
+    __atomic_store_n(&(p->tail), tail, __ATOMIC_RELEASE);
+  }
+
+  return (void *)0;
+}
+
+static void print_hist(const char *title, const uint64_t *hist)
+{
+  int i;
+
+  printf("    %s:", title);
+  for(i=0; i<CHECK_HIST_BINS; i++)
+  {
+    if(hist[i])
+    {
+      printf(" <%dus:%llu", 1 << (i + 1), (unsigned long long) hist[i]);
+    }
+  }
+  printf("\n");
+
+  return;
+}
+
+void report(int verbose)
+{
+  CHECK_STATS *st;
+  double span_s;
+  int i;
+
+  pthread_mutex_lock(&lock_stats);
+  for(i=0; i<CHECK_STREAMS; i++)
+  {
+    st = &(stats[i]);
+    if(st->packets == 0)
+    {
+      continue;
+    }
+
+    span_s = (double) (st->last_arrival_ns - st->first_arrival_ns) / NSEC_PER_SEC;
+
+    printf("%s: %llu pkts %.1f pkt/s %.1f samples/s %.1f kB/s", stream_name[i],
+      (unsigned long long) st->packets,
+      span_s > 0 ? (st->packets - 1) / span_s : 0.0,
+      span_s > 0 ? st->samples / span_s : 0.0,
+      span_s > 0 ? st->bytes / span_s / 1000.0 : 0.0);
+
+    if(i == CHECK_STREAM_CONT || i == CHECK_STREAM_SCAN)
+    {
+      printf(" gaps %llu reordered %llu invalid %llu latency min/avg/max %lld/%.0f/%lld us",
+        (unsigned long long) st->gaps, (unsigned long long) st->reordered, (unsigned long long) st->errors,
+        (long long) st->lat_min_us, st->lat_samples ? st->lat_sum_us / st->lat_samples : 0.0, (long long) st->lat_max_us);
+    }
+    printf("\n");
+
+    if(verbose)
+    {
+      print_hist("inter-arrival", st->iat_hist);
+      if(i == CHECK_STREAM_CONT || i == CHECK_STREAM_SCAN)
+      {
+        print_hist("latency", st->lat_hist);
+      }
+    }
+  }
+  pthread_mutex_unlock(&lock_stats);
+
+  if(pipe_rx.dropped)
+  {
+    printf("stats pipeline overflow: %llu records dropped\n", (unsigned long long) pipe_rx.dropped);
+  }
+
+  return;
+}
+
+void usage(const char *name)
+{
+  printf("Usage: %s [-t seconds] [-i report_interval_s]\n", name);
+
+  return;
+}
+
+/*******************************************************************************
+* main program
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+  pthread_t r_tid, a_tid;
+  struct sockaddr_in sin;
+  int duration = 0, interval = 1, elapsed = 0;
+  int opt, i, on = 1, rcvbuf = 4 * 1024 * 1024;
+
+  signal(SIGINT, sigint_handler);
+
+  while((opt = getopt(argc, argv, "t:i:h")) != -1)
+  {
+    switch(opt)
+    {
+      case 't':
+        duration = atoi(optarg);
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        exit(opt == 'h' ? 0 : 1);
+    }
+  }
+
+  if(interval < 1)
+  {
+    interval = 1;
+  }
+
+  stop_process = 0;
+
+  for(i=0; i<CHECK_STREAMS; i++)
+  {
+    if((r_socket[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+    {
+      printf("Unable to open %s socket.\n", stream_name[i]);
+      exit(1);
+    }
+
+    setsockopt(r_socket[i], SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    setsockopt(r_socket[i], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(stream_port[i]);
+    if(inet_aton(CHECK_LISTEN_IP_ADD, &(sin.sin_addr)) == 0)
+    {
+      printf("Invalid listen IP address.\n");
+      exit(1);
+    }
+
+    if(bind(r_socket[i], (struct sockaddr *) &sin, sizeof(sin)) == -1)
+    {
+      printf("%s socket bind failed.\n", stream_name[i]);
+      exit(1);
+    }
+
+    printf("Listening for %s frames on %s:%d.\n", stream_name[i], inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
+  }
+
+  pthread_create(&r_tid, NULL, rx_th, NULL);
+  pthread_create(&a_tid, NULL, stats_th, NULL);
+
+  while(!stop_process && (duration == 0 || elapsed < duration))
+  {
+    sleep(interval);
+    elapsed += interval;
+    report(0);
+  }
+
+  stop_process = 1;
+
+  pthread_join(r_tid, NULL);
+  pthread_join(a_tid, NULL);
+
+  printf("Final report:\n");
+  report(1);
+
+  for(i=0; i<CHECK_STREAMS; i++)
+  {
+    close(r_socket[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,228 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <libutils/utils.h>
+
+#include "../include/stream_clock.h"
+#include "../include/shm_ring.h"
+
+/*******************************************************************************
+* constants
+*******************************************************************************/
+#define READER_STREAMS 2
+#define READER_WAIT_MS 200
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+typedef struct {
+  const char *suffix;
+  char     name[SHM_RING_NAME_LEN];
+  SHM_RING ring;
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t gaps;       // missing ulFrameCount values
+  uint8_t  have_last;
+  uint32_t last_counter;
+  int64_t  lat_min_ns;
+  int64_t  lat_max_ns;
+  int64_t  lat_sum_ns;
+  pthread_mutex_t lock;
+} READER_STREAM;
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+volatile sig_atomic_t stop_process;
+
+READER_STREAM streams[READER_STREAMS] = {{.suffix = "cont"}, {.suffix = "scan"}};
+
+/*******************************************************************************
+* signal handling
+*******************************************************************************/
+void sigint_handler(int signal) {
+  stop_process = 1;
+}
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static int64_t now_ns()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return timespec_to_ns(&now);
+}
+
+// Reference consumer of one ring: frames are read in place and released,
+// nothing is copied. The segment is (re)attached whenever the emulator
+// (re)creates it.
+void *reader_th(void *args)
+{
+  READER_STREAM *st = (READER_STREAM *) args;
+  const uint8_t *frame;
+  size_t len;
+  int64_t stamp_ns, lat_ns;
+  uint32_t counter;
+
+  while(!stop_process)
+  {
+    if(!st->ring.active || !__atomic_load_n(&(st->ring.hdr->state), __ATOMIC_ACQUIRE))
+    {
+      pthread_mutex_lock(&(st->lock)); // report reads the segment header
+      shm_ring_close(&(st->ring));
+      if(shm_ring_attach(&(st->ring), st->name) != 0)
+      {
+        pthread_mutex_unlock(&(st->lock));
+        usleep(READER_WAIT_MS * 1000);
+        continue;
+      }
+      pthread_mutex_unlock(&(st->lock));
+      printf("Attached to %s.\n", st->name);
+      st->have_last = 0;
+    }
+
+    if(shm_ring_wait(&(st->ring), READER_WAIT_MS) != 0)
+    {
+      continue;
+    }
+
+    while((frame = shm_ring_peek(&(st->ring), &len, &stamp_ns)) != NULL)
+    {
+      lat_ns = now_ns() - stamp_ns;
+
+      pthread_mutex_lock(&(st->lock));
+      st->frames++;
+      st->bytes += len;
+      if(len >= 8)
+      {
+        read_32((uint8_t *) frame + 4, &counter, BE);
+        if(st->have_last && counter != st->last_counter + 1)
+        {
+          st->gaps += (uint32_t) (counter - st->last_counter - 1);
+        }
+        st->last_counter = counter;
+        st->have_last = 1;
+      }
+      if(st->frames == 1 || lat_ns < st->lat_min_ns)
+      {
+        st->lat_min_ns = lat_ns;
+      }
+      if(lat_ns > st->lat_max_ns)
+      {
+        st->lat_max_ns = lat_ns;
+      }
+      st->lat_sum_ns += lat_ns;
+      pthread_mutex_unlock(&(st->lock));
+
+      shm_ring_release(&(st->ring));
+    }
+  }
+
+  return (void *)0;
+}
+
+void report(double interval_s)
+{
+  READER_STREAM *st;
+  int i;
+
+  for(i=0; i<READER_STREAMS; i++)
+  {
+    st = &(streams[i]);
+
+    pthread_mutex_lock(&(st->lock));
+    printf("%s: %lu frames %.1f frame/s %.1f kB/s gaps %lu dropped %lu latency min/avg/max %.1f/%.1f/%.1f us\n",
+           st->suffix, st->frames, st->frames / interval_s, st->bytes / interval_s / 1000.0, st->gaps,
+           st->ring.active ? __atomic_load_n(&(st->ring.hdr->dropped), __ATOMIC_RELAXED) : 0,
+           st->lat_min_ns / 1000.0, st->frames ? (double) st->lat_sum_ns / st->frames / 1000.0 : 0.0, st->lat_max_ns / 1000.0);
+    st->frames = 0;
+    st->bytes = 0;
+    st->gaps = 0;
+    st->lat_min_ns = 0;
+    st->lat_max_ns = 0;
+    st->lat_sum_ns = 0;
+    pthread_mutex_unlock(&(st->lock));
+  }
+
+  return;
+}
+
+void usage(const char *name)
+{
+  printf("Usage: %s [-n name] [-t seconds] [-i interval]\n", name);
+  printf("  -n  shared memory name given to smartscanemu -z (default %s)\n", SHM_RING_NAME);
+  printf("  -t  stop after the given number of seconds (default: until SIGINT)\n");
+  printf("  -i  report interval in seconds (default 1)\n");
+
+  return;
+}
+
+/*******************************************************************************
+* main program
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+  const char *name = SHM_RING_NAME;
+  pthread_t tid[READER_STREAMS];
+  void *result;
+  int duration = 0, interval = 1, elapsed = 0;
+  int opt, i;
+
+  signal(SIGINT, sigint_handler);
+  signal(SIGTERM, sigint_handler);
+
+  while((opt = getopt(argc, argv, "n:t:i:h")) != -1)
+  {
+    switch(opt)
+    {
+      case 'n':
+        name = optarg;
+        break;
+      case 't':
+        duration = atoi(optarg);
+        break;
+      case 'i':
+        interval = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      default:
+        usage(argv[0]);
+        exit(opt == 'h' ? 0 : 1);
+    }
+  }
+
+  for(i=0; i<READER_STREAMS; i++)
+  {
+    snprintf(streams[i].name, SHM_RING_NAME_LEN, "%s.%s", name, streams[i].suffix);
+    pthread_mutex_init(&(streams[i].lock), NULL);
+    pthread_create(&(tid[i]), NULL, reader_th, &(streams[i]));
+  }
+
+  while(!stop_process && (duration == 0 || elapsed < duration))
+  {
+    sleep(interval);
+    elapsed += interval;
+    report((double) interval);
+  }
+
+  stop_process = 1;
+
+  for(i=0; i<READER_STREAMS; i++)
+  {
+    pthread_join(tid[i], &result);
+    shm_ring_close(&(streams[i].ring));
+    pthread_mutex_destroy(&(streams[i].lock));
+  }
+
+  return 0;
+}
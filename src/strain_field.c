@@ -0,0 +1,569 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/strain_field.h"
+#include "../include/cont_payload.h"
+#include "../include/stream_clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+
+#include <libutils/utils.h>
+#include <libsmartscan/smartscan_utils.h>
+
+/*******************************************************************************
+* types
+*******************************************************************************/
+// cache file: this header, then the n(n+1)/2 factor entries row by row
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n;
+  uint32_t reserved;
+  uint64_t key;        // hash of the sensors and the covariance parameters
+} FIELD_CACHE_HDR;
+
+// per thread unit normals of the two knots around the current sample and
+// their interpolation, filled only up to the sensors requested so far
+typedef struct {
+  float    knot[2][FIELD_MAX_SENSORS] __attribute__((aligned(32))); // knot k in knot[k & 1]
+  float    z[FIELD_MAX_SENSORS] __attribute__((aligned(32)));
+  uint64_t knot_id[2];
+  size_t   knot_nr[2];
+  uint64_t sample_id;
+  size_t   z_nr;
+} FIELD_SCRATCH;
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+STRAIN_FIELD strain_field;
+
+static __thread FIELD_SCRATCH scratch = {.knot_id = {UINT64_MAX, UINT64_MAX}, .sample_id = UINT64_MAX};
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  size_t i;
+
+  for(i=0; i<len; i++)
+  {
+    hash = (hash ^ p[i]) * 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+static uint64_t field_key(const STRAIN_FIELD *field)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  double params[5] = {field->strain_sigma, field->strain_length, field->temp_sigma, field->temp_length, field->noise_sigma};
+  size_t i;
+
+  for(i=0; i<field->n; i++)
+  {
+    hash = fnv1a(hash, &(field->sensor[i].channel), 1);
+    hash = fnv1a(hash, &(field->sensor[i].grating), 1);
+    hash = fnv1a(hash, &(field->sensor[i].x), 3 * sizeof(double));
+  }
+
+  return fnv1a(hash, params, sizeof(params));
+}
+
+static int compare_sensors(const void *a, const void *b)
+{
+  const FIELD_SENSOR *sa = (const FIELD_SENSOR *) a;
+  const FIELD_SENSOR *sb = (const FIELD_SENSOR *) b;
+  int ka = sa->channel * FIELD_MAX_GRATINGS + sa->grating;
+  int kb = sb->channel * FIELD_MAX_GRATINGS + sb->grating;
+
+  return (ka > kb) - (ka < kb);
+}
+
+// Each line is either a parameter or a sensor:
+//   strain      <sigma> <length_m>
+//   temperature <sigma> <length_m>
+//   noise       <sigma>
+//   knots       <samples>
+//   <channel> <grating> <x_m> <y_m> [z_m]
+// '#' starts a comment.
+static int parse_layout(STRAIN_FIELD *field, const char *path)
+{
+  FILE *f;
+  char line[FIELD_LINE_SIZE], name[32], extra[32];
+  unsigned channel, grating;
+  double a1, a2, a3;
+  int fields, line_nr = 0, error_code = 0;
+  char *comment;
+  size_t i;
+
+  if((f = fopen(path, "r")) == NULL)
+  {
+    printf("Unable to open sensor layout %s.\n", path);
+    return -1;
+  }
+
+  while(error_code == 0 && fgets(line, sizeof(line), f))
+  {
+    line_nr++;
+
+    if((comment = strchr(line, '#')) != NULL)
+    {
+      *comment = '\0';
+    }
+
+    if(sscanf(line, "%31s", name) != 1)
+    {
+      continue;
+    }
+
+    if(strcasecmp(name, "strain") == 0 || strcasecmp(name, "temperature") == 0)
+    {
+      fields = sscanf(line, "%*s %lf %lf %31s", &a1, &a2, extra);
+      if(fields != 2 || a1 < 0 || a2 <= 0)
+      {
+        error_code = -1;
+      }
+      else if(strcasecmp(name, "strain") == 0)
+      {
+        field->strain_sigma = a1;
+        field->strain_length = a2;
+      }
+      else
+      {
+        field->temp_sigma = a1;
+        field->temp_length = a2;
+      }
+    }
+    else if(strcasecmp(name, "noise") == 0)
+    {
+      fields = sscanf(line, "%*s %lf %31s", &a1, extra);
+      if(fields != 1 || a1 < 0)
+      {
+        error_code = -1;
+      }
+      field->noise_sigma = a1;
+    }
+    else if(strcasecmp(name, "knots") == 0)
+    {
+      fields = sscanf(line, "%*s %lf %31s", &a1, extra);
+      if(fields != 1 || a1 < 1 || a1 > UINT32_MAX)
+      {
+        error_code = -1;
+      }
+      field->knot_samples = (uint32_t) a1;
+    }
+    else
+    {
+      a3 = 0.0;
+      fields = sscanf(line, "%u %u %lf %lf %lf %31s", &channel, &grating, &a1, &a2, &a3, extra);
+      if(fields < 4 || fields > 5 || channel >= FIELD_MAX_CHANNELS || grating >= FIELD_MAX_GRATINGS ||
+         field->row[channel][grating] >= 0 || field->n >= FIELD_MAX_SENSORS)
+      {
+        error_code = -1;
+      }
+      else
+      {
+        field->row[channel][grating] = (int16_t) field->n;
+        field->sensor[field->n].channel = (uint8_t) channel;
+        field->sensor[field->n].grating = (uint8_t) grating;
+        field->sensor[field->n].x = a1;
+        field->sensor[field->n].y = a2;
+        field->sensor[field->n].z = a3;
+        field->n++;
+      }
+    }
+
+    if(error_code != 0)
+    {
+      printf("Invalid sensor layout line at %s:%d.\n", path, line_nr);
+    }
+  }
+
+  fclose(f);
+
+  if(error_code == 0 && field->n == 0)
+  {
+    printf("Sensor layout %s has no sensors.\n", path);
+    error_code = -1;
+  }
+
+  if(error_code == 0)
+  {
+    // rows in channel and grating order, so a channel reads one block of the factor
+    qsort(field->sensor, field->n, sizeof(FIELD_SENSOR), compare_sensors);
+    for(i=0; i<field->n; i++)
+    {
+      field->row[field->sensor[i].channel][field->sensor[i].grating] = (int16_t) i;
+    }
+  }
+
+  return error_code;
+}
+
+static size_t padded(size_t len)
+{
+  return (len + FIELD_LANES - 1) / FIELD_LANES * FIELD_LANES;
+}
+
+// packed lower triangle in row order into the padded rows of the factor
+static int alloc_factor(STRAIN_FIELD *field)
+{
+  size_t i, total = 0;
+
+  for(i=0; i<field->n; i++)
+  {
+    field->offset[i] = (uint32_t) total;
+    total += padded(i + 1);
+  }
+
+  if(posix_memalign((void **) &(field->factor), 64, total * sizeof(float)) != 0)
+  {
+    field->factor = NULL;
+    printf("Unable to allocate the correlation factor.\n");
+    return -1;
+  }
+  memset(field->factor, 0, total * sizeof(float));
+
+  return 0;
+}
+
+static double kernel(const STRAIN_FIELD *field, const FIELD_SENSOR *a, const FIELD_SENSOR *b)
+{
+  double dx = a->x - b->x, dy = a->y - b->y, dz = a->z - b->z;
+  double d2 = dx*dx + dy*dy + dz*dz;
+
+  return field->strain_sigma * field->strain_sigma * exp(-d2 / (2.0 * field->strain_length * field->strain_length)) +
+         field->temp_sigma * field->temp_sigma * exp(-d2 / (2.0 * field->temp_length * field->temp_length));
+}
+
+// Cholesky-Banachiewicz in double, row by row into the float factor
+static int compute_factor(STRAIN_FIELD *field)
+{
+  size_t n = field->n, i, j, k;
+  double *l, sum;
+
+  if((l = (double *) malloc(n * n * sizeof(double))) == NULL)
+  {
+    printf("Unable to allocate the covariance matrix.\n");
+    return -1;
+  }
+
+  for(i=0; i<n; i++)
+  {
+    for(j=0; j<=i; j++)
+    {
+      sum = kernel(field, &(field->sensor[i]), &(field->sensor[j]));
+      if(i == j)
+      {
+        sum += field->noise_sigma * field->noise_sigma;
+      }
+      for(k=0; k<j; k++)
+      {
+        sum -= l[i*n + k] * l[j*n + k];
+      }
+
+      if(i == j)
+      {
+        if(sum <= 0.0)
+        {
+          printf("Sensor covariance is not positive definite at grating %u of channel %u: coincident sensors need noise > 0.\n",
+                 field->sensor[i].grating, field->sensor[i].channel);
+          free(l);
+          return -1;
+        }
+        l[i*n + i] = sqrt(sum);
+      }
+      else
+      {
+        l[i*n + j] = sum / l[j*n + j];
+      }
+      field->factor[field->offset[i] + j] = (float) l[i*n + j];
+    }
+  }
+
+  free(l);
+
+  return 0;
+}
+
+static int read_cache(STRAIN_FIELD *field, const char *path, uint64_t key)
+{
+  FIELD_CACHE_HDR hdr;
+  FILE *f;
+  size_t i;
+  int error_code = 0;
+
+  if((f = fopen(path, "rb")) == NULL)
+  {
+    return -1;
+  }
+
+  if(fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != FIELD_CACHE_MAGIC || hdr.version != FIELD_CACHE_VERSION ||
+     hdr.n != field->n || hdr.key != key)
+  {
+    error_code = -1;
+  }
+
+  for(i=0; i<field->n && error_code == 0; i++)
+  {
+    if(fread(field->factor + field->offset[i], sizeof(float), i + 1, f) != i + 1)
+    {
+      error_code = -1;
+    }
+  }
+
+  fclose(f);
+
+  return error_code;
+}
+
+// written under a temporary name and renamed, so a reader never sees half a file
+static void write_cache(STRAIN_FIELD *field, const char *path, uint64_t key)
+{
+  FIELD_CACHE_HDR hdr = {FIELD_CACHE_MAGIC, FIELD_CACHE_VERSION, (uint32_t) field->n, 0, key};
+  char tmp_path[FIELD_LINE_SIZE + 8];
+  FILE *f;
+  size_t i;
+  int error_code = 0;
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  if((f = fopen(tmp_path, "wb")) == NULL)
+  {
+    printf("Unable to write correlation cache %s: %s.\n", tmp_path, strerror(errno));
+    return;
+  }
+
+  error_code = (fwrite(&hdr, sizeof(hdr), 1, f) == 1) ? 0 : -1;
+  for(i=0; i<field->n && error_code == 0; i++)
+  {
+    if(fwrite(field->factor + field->offset[i], sizeof(float), i + 1, f) != i + 1)
+    {
+      error_code = -1;
+    }
+  }
+
+  if(fclose(f) != 0 || error_code != 0 || rename(tmp_path, path) != 0)
+  {
+    printf("Unable to write correlation cache %s.\n", path);
+    remove(tmp_path);
+    return;
+  }
+
+  printf("Correlation factor cached to %s.\n", path);
+
+  return;
+}
+
+int strain_field_load(STRAIN_FIELD *field, const char *path)
+{
+  char cache_path[FIELD_LINE_SIZE];
+  int64_t start_ns;
+  uint64_t key;
+
+  memset(field, 0, sizeof(*field));
+  memset(field->row, 0xff, sizeof(field->row));
+  field->strain_sigma = FIELD_STRAIN_SIGMA;
+  field->strain_length = FIELD_STRAIN_LENGTH;
+  field->temp_sigma = FIELD_TEMP_SIGMA;
+  field->temp_length = FIELD_TEMP_LENGTH;
+  field->noise_sigma = FIELD_NOISE_SIGMA;
+  field->knot_samples = FIELD_KNOT_SAMPLES;
+
+  if(parse_layout(field, path) != 0 || alloc_factor(field) != 0)
+  {
+    return -1;
+  }
+
+  if(snprintf(cache_path, sizeof(cache_path), "%s%s", path, FIELD_CACHE_SUFFIX) >= (int) sizeof(cache_path))
+  {
+    printf("Sensor layout path is too long.\n");
+    strain_field_free(field);
+    return -1;
+  }
+
+  key = field_key(field);
+  start_ns = stream_clock_real_ns();
+
+  if(read_cache(field, cache_path, key) == 0)
+  {
+    printf("Correlation factor of %zu sensors loaded from %s in %.1f ms.\n", field->n, cache_path,
+           (double) (stream_clock_real_ns() - start_ns) / 1e6);
+  }
+  else
+  {
+    if(compute_factor(field) != 0)
+    {
+      strain_field_free(field);
+      return -1;
+    }
+    printf("Correlation factor of %zu sensors computed in %.1f ms.\n", field->n,
+           (double) (stream_clock_real_ns() - start_ns) / 1e6);
+    write_cache(field, cache_path, key);
+  }
+
+  field->active = 1;
+
+  printf("Sensor layout %s loaded: %zu sensors, strain %.1f over %.2f m, temperature %.1f over %.2f m, new field every %u samples.\n",
+         path, field->n, field->strain_sigma, field->strain_length, field->temp_sigma, field->temp_length, field->knot_samples);
+
+  return 0;
+}
+
+void strain_field_free(STRAIN_FIELD *field)
+{
+  free(field->factor);
+  field->factor = NULL;
+  field->active = 0;
+
+  return;
+}
+
+// unit normals of knot k for sensors [first, last), Box-Muller on one
+// splitmix64 draw per sensor whose state is reached directly from k and j
+static void fill_knot(float *knot, uint64_t k, size_t first, size_t last)
+{
+  uint64_t base = (payload_seed ^ 0x5bd1e9955bd1e995ULL) ^ (k * 0xd1b54a32d192ed03ULL);
+  uint64_t z;
+  double u1, u2;
+  size_t j;
+
+  for(j=first; j<last; j++)
+  {
+    z = base + (uint64_t) (j + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+
+    u1 = ((double) (z >> 32) + 1.0) / 4294967296.0; // (0, 1]
+    u2 = (double) (z & 0xffffffffu) / 4294967296.0;
+    knot[j] = (float) (sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+  }
+
+  return;
+}
+
+static const float *knot_normals(uint64_t k, size_t nr)
+{
+  int s = (int) (k & 1);
+
+  if(scratch.knot_id[s] != k)
+  {
+    scratch.knot_id[s] = k;
+    scratch.knot_nr[s] = 0;
+  }
+  if(scratch.knot_nr[s] < nr)
+  {
+    fill_knot(scratch.knot[s], k, scratch.knot_nr[s], nr);
+    scratch.knot_nr[s] = nr;
+  }
+
+  return scratch.knot[s];
+}
+
+// z of the sample for sensors [0, nr); entries past n stay zero for the padded rows
+static const float *sample_normals(STRAIN_FIELD *field, uint64_t sample_id, size_t nr)
+{
+  uint64_t k = sample_id / field->knot_samples;
+  const float *a, *b;
+  float w, wa, wb, norm;
+  size_t j;
+
+  if(scratch.sample_id != sample_id)
+  {
+    scratch.sample_id = sample_id;
+    scratch.z_nr = 0;
+  }
+  if(scratch.z_nr >= nr)
+  {
+    return scratch.z;
+  }
+
+  a = knot_normals(k, nr);
+  if(field->knot_samples == 1)
+  {
+    memcpy(scratch.z + scratch.z_nr, a + scratch.z_nr, (nr - scratch.z_nr) * sizeof(float));
+  }
+  else
+  {
+    b = knot_normals(k + 1, nr);
+    // smoothstep between the knots, rescaled to keep unit variance
+    w = (float) (sample_id % field->knot_samples) / (float) field->knot_samples;
+    w = w * w * (3.0f - 2.0f * w);
+    norm = 1.0f / sqrtf((1.0f - w) * (1.0f - w) + w * w);
+    wa = (1.0f - w) * norm;
+    wb = w * norm;
+    for(j=scratch.z_nr; j<nr; j++)
+    {
+      scratch.z[j] = wa * a[j] + wb * b[j];
+    }
+  }
+  scratch.z_nr = nr;
+
+  return scratch.z;
+}
+
+// FIELD_LANES independent accumulators: the compiler maps them to one vector register
+static float dot_lanes(const float *restrict row, const float *restrict z, size_t len)
+{
+  float acc[FIELD_LANES] = {0};
+  float sum = 0.0f;
+  size_t i, k;
+
+  for(i=0; i<len; i+=FIELD_LANES)
+  {
+    for(k=0; k<FIELD_LANES; k++)
+    {
+      acc[k] += row[i + k] * z[i + k];
+    }
+  }
+  for(k=0; k<FIELD_LANES; k++)
+  {
+    sum += acc[k];
+  }
+
+  return sum;
+}
+
+// the gratings of one channel: one row of the matrix-vector product each,
+// gratings missing from the layout read the base value
+void strain_field_values(STRAIN_FIELD *field, uint8_t *values, uint8_t channel, uint8_t gratings, uint64_t sample_id)
+{
+  const float *z;
+  size_t g, last = 0;
+  uint16_t tmp16;
+  int r, value;
+
+  for(g=0; g<gratings && g<FIELD_MAX_GRATINGS && channel<FIELD_MAX_CHANNELS; g++)
+  {
+    if(field->row[channel][g] >= 0 && (size_t) field->row[channel][g] + 1 > last)
+    {
+      last = (size_t) field->row[channel][g] + 1;
+    }
+  }
+
+  z = sample_normals(field, sample_id, padded(last) < field->n ? padded(last) : field->n);
+
+  for(g=0; g<gratings; g++)
+  {
+    r = (g < FIELD_MAX_GRATINGS && channel < FIELD_MAX_CHANNELS) ? field->row[channel][g] : -1;
+    value = CONT_VALUE_BASE;
+    if(r >= 0)
+    {
+      value += (int) lrintf(dot_lanes(field->factor + field->offset[r], z, padded((size_t) r + 1)));
+      value = value < 0 ? 0 : (value > CONT_VALUE_MAX ? CONT_VALUE_MAX : value);
+    }
+    tmp16 = (uint16_t) (value * LASER_CHANNEL_MULT);
+    write_16(&tmp16, values + g*sizeof(uint16_t), BE);
+  }
+
+  return;
+}
@@ -0,0 +1,319 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/stream_clock.h"
+
+#include <errno.h>
+
+/*******************************************************************************
+* global variables
+*******************************************************************************/
+int64_t ts_offset_ns = 0;
+double  ts_drift_ppm = 0.0;
+
+VIRTUAL_CLOCK virtual_clock = {0, 0, 0, 0, 0, -1, {0}, {0}, {0}, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static __thread int virtual_id = -1;
+
+#define VIRTUAL_DETACHED 0
+#define VIRTUAL_WAITING  1
+#define VIRTUAL_RUNNING  2
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+int64_t timespec_to_ns(const struct timespec *ts)
+{
+  return (int64_t) ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+void ns_to_timespec(int64_t ns, struct timespec *ts)
+{
+  ts->tv_sec = ns / NSEC_PER_SEC;
+  ts->tv_nsec = ns % NSEC_PER_SEC;
+  if(ts->tv_nsec < 0)
+  {
+    ts->tv_sec -= 1;
+    ts->tv_nsec += NSEC_PER_SEC;
+  }
+}
+
+static int64_t read_clock_ns(clockid_t id)
+{
+  struct timespec ts;
+
+  if(virtual_clock.enabled)
+  {
+    return __atomic_load_n(&(virtual_clock.now_ns), __ATOMIC_ACQUIRE) + (id == CLOCK_REALTIME ? virtual_clock.real_epoch_ns : 0);
+  }
+
+  clock_gettime(id, &ts);
+
+  return timespec_to_ns(&ts);
+}
+
+// anchor sample 0 of the stream to the current instant
+void stream_clock_start(STREAM_CLOCK *clk, uint32_t period_us)
+{
+  clk->mono_epoch_ns = read_clock_ns(CLOCK_MONOTONIC);
+  clk->real_epoch_ns = read_clock_ns(CLOCK_REALTIME);
+  clk->now_ns = clk->mono_epoch_ns;
+  clk->index = 0;
+  clk->period_us = period_us;
+  clk->running = 1;
+
+  return;
+}
+
+void stream_clock_stop(STREAM_CLOCK *clk)
+{
+  clk->running = 0;
+
+  return;
+}
+
+// move the epoch to the next scheduled sample so that changing the period
+// does not rescale the time already elapsed
+void stream_clock_set_period(STREAM_CLOCK *clk, uint32_t period_us)
+{
+  int64_t elapsed_ns;
+
+  if(!clk->running)
+  {
+    stream_clock_start(clk, period_us);
+    return;
+  }
+
+  if(clk->period_us == period_us)
+  {
+    return;
+  }
+
+  elapsed_ns = (int64_t) clk->index * clk->period_us * NSEC_PER_USEC;
+
+  clk->mono_epoch_ns += elapsed_ns;
+  clk->real_epoch_ns += elapsed_ns + (int64_t) ((double) elapsed_ns * ts_drift_ppm * 1e-6);
+  clk->index = 0;
+  clk->period_us = period_us;
+
+  return;
+}
+
+// single vDSO clock read per batch, every timestamp of the batch is derived
+// arithmetically from the epoch; a stream that fell too far behind (suspended
+// host, long stall) is re-anchored rather than flooding to catch up
+int64_t stream_clock_refresh(STREAM_CLOCK *clk)
+{
+  clk->now_ns = read_clock_ns(CLOCK_MONOTONIC);
+
+  if(clk->now_ns - stream_clock_deadline(clk, clk->index) > STREAM_CLOCK_MAX_LAG_NS)
+  {
+    stream_clock_start(clk, clk->period_us);
+  }
+
+  return clk->now_ns;
+}
+
+int64_t stream_clock_deadline(STREAM_CLOCK *clk, uint64_t index)
+{
+  return clk->mono_epoch_ns + (int64_t) index * clk->period_us * NSEC_PER_USEC;
+}
+
+void stream_clock_stamp(STREAM_CLOCK *clk, uint64_t index, struct timespec *stamp)
+{
+  int64_t elapsed_ns = (int64_t) index * clk->period_us * NSEC_PER_USEC;
+  int64_t stamp_ns;
+
+  stamp_ns = clk->real_epoch_ns + elapsed_ns;
+  stamp_ns += (int64_t) ((double) elapsed_ns * ts_drift_ppm * 1e-6);
+  stamp_ns += ts_offset_ns;
+
+  ns_to_timespec(stamp_ns, stamp);
+
+  return;
+}
+
+void stream_clock_wait_until(STREAM_CLOCK *clk, int64_t deadline_ns)
+{
+  struct timespec deadline;
+
+  if(virtual_clock.enabled)
+  {
+    virtual_clock_wait(deadline_ns, 0);
+    clk->now_ns = read_clock_ns(CLOCK_MONOTONIC);
+    return;
+  }
+
+  if(deadline_ns > clk->now_ns)
+  {
+    ns_to_timespec(deadline_ns, &deadline);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+    clk->now_ns = deadline_ns;
+  }
+
+  return;
+}
+
+// sleep until the deadline of the next sample
+void stream_clock_wait(STREAM_CLOCK *clk)
+{
+  stream_clock_refresh(clk);
+  stream_clock_wait_until(clk, stream_clock_deadline(clk, clk->index));
+
+  return;
+}
+
+int64_t stream_clock_real_ns()
+{
+  return read_clock_ns(CLOCK_REALTIME);
+}
+
+/*******************************************************************************
+* virtual time
+*******************************************************************************/
+// hand the clock to the waiting thread with the earliest deadline once no
+// thread runs and all expected threads have attached (lock held)
+static void virtual_schedule()
+{
+  VIRTUAL_CLOCK *vc = &virtual_clock;
+  int i, next = -1;
+
+  if(vc->running != -1 || vc->attached < vc->expected)
+  {
+    return;
+  }
+
+  for(i=0; i<VIRTUAL_CLOCK_MAX; i++)
+  {
+    if(vc->state[i] == VIRTUAL_WAITING && (next == -1 || vc->deadline_ns[i] < vc->deadline_ns[next]))
+    {
+      next = i;
+    }
+  }
+
+  if(next == -1)
+  {
+    return;
+  }
+
+  if(vc->deadline_ns[next] > vc->now_ns)
+  {
+    __atomic_store_n(&(vc->now_ns), vc->deadline_ns[next], __ATOMIC_RELEASE);
+  }
+  vc->state[next] = VIRTUAL_RUNNING;
+  vc->idle[next] = 0;
+  vc->running = next;
+  pthread_cond_broadcast(&(vc->cv));
+
+  return;
+}
+
+void virtual_clock_enable(int64_t real_epoch_ns, int threads)
+{
+  virtual_clock.real_epoch_ns = real_epoch_ns;
+  virtual_clock.expected = threads;
+  virtual_clock.enabled = 1;
+
+  return;
+}
+
+// register the calling thread and wait for its first turn
+void virtual_clock_attach(int id)
+{
+  VIRTUAL_CLOCK *vc = &virtual_clock;
+
+  if(!vc->enabled || id < 0 || id >= VIRTUAL_CLOCK_MAX)
+  {
+    return;
+  }
+
+  virtual_id = id;
+
+  pthread_mutex_lock(&(vc->lock));
+  vc->deadline_ns[id] = vc->now_ns;
+  vc->state[id] = VIRTUAL_WAITING;
+  vc->attached++;
+  virtual_schedule();
+  while(vc->running != id)
+  {
+    pthread_cond_wait(&(vc->cv), &(vc->lock));
+  }
+  pthread_mutex_unlock(&(vc->lock));
+
+  return;
+}
+
+void virtual_clock_detach()
+{
+  VIRTUAL_CLOCK *vc = &virtual_clock;
+
+  if(!vc->enabled || virtual_id == -1)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&(vc->lock));
+  vc->state[virtual_id] = VIRTUAL_DETACHED;
+  if(vc->running == virtual_id)
+  {
+    vc->running = -1;
+  }
+  virtual_id = -1;
+  virtual_schedule();
+  pthread_mutex_unlock(&(vc->lock));
+
+  return;
+}
+
+// give the clock up until deadline_ns; an idle wait also ends at the next
+// virtual_clock_interrupt()
+void virtual_clock_wait(int64_t deadline_ns, int idle)
+{
+  VIRTUAL_CLOCK *vc = &virtual_clock;
+  int id = virtual_id;
+
+  if(id == -1)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&(vc->lock));
+  vc->deadline_ns[id] = deadline_ns;
+  vc->idle[id] = (uint8_t) idle;
+  vc->state[id] = VIRTUAL_WAITING;
+  vc->running = -1;
+  virtual_schedule();
+  while(vc->running != id)
+  {
+    pthread_cond_wait(&(vc->cv), &(vc->lock));
+  }
+  pthread_mutex_unlock(&(vc->lock));
+
+  return;
+}
+
+// a configuration change: idle threads resume at the current instant
+void virtual_clock_interrupt()
+{
+  VIRTUAL_CLOCK *vc = &virtual_clock;
+  int i;
+
+  if(!vc->enabled)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&(vc->lock));
+  for(i=0; i<VIRTUAL_CLOCK_MAX; i++)
+  {
+    if(vc->state[i] == VIRTUAL_WAITING && vc->idle[i])
+    {
+      vc->deadline_ns[i] = vc->now_ns;
+      vc->idle[i] = 0;
+    }
+  }
+  virtual_schedule();
+  pthread_mutex_unlock(&(vc->lock));
+
+  return;
+}
@@ -0,0 +1,501 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/tcp_stream.h"
+#include "../include/footprint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+// drop one reference to a pool frame (lock held)
+static void frame_put(TCP_STREAM *srv, uint16_t frame)
+{
+  if(--srv->ref[frame] == 0)
+  {
+    srv->free_list[srv->free_nr++] = frame;
+  }
+
+  return;
+}
+
+static void close_client(TCP_STREAM *srv, TCP_CLIENT *c)
+{
+  unsigned i;
+
+  printf("Closing TCP client %s:%d, %lu frames sent, %lu dropped, %lu zerocopy sends copied.\n",
+         inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port), c->sent, c->dropped, c->copied);
+
+  close(c->fd);
+
+  pthread_mutex_lock(&(srv->lock));
+  for(; c->head != c->tail; c->head++)
+  {
+    frame_put(srv, c->queue[c->head % TCP_CLIENT_QUEUE]);
+  }
+  for(i=0; i<c->send_nr; i++)
+  {
+    frame_put(srv, c->send[i]);
+  }
+  for(; c->zc_head != c->zc_tail; c->zc_head++)
+  {
+    frame_put(srv, c->zc[c->zc_head % TCP_ZC_MAX].frame);
+  }
+  c->active = 0;
+  srv->client_nr--;
+  pthread_mutex_unlock(&(srv->lock));
+
+  return;
+}
+
+static void accept_clients(TCP_STREAM *srv)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  TCP_CLIENT *c = NULL;
+  int fd, one = 1, i;
+
+  while((fd = accept(srv->listen_fd, (struct sockaddr *) &addr, &len)) != -1)
+  {
+    for(i=0, c=NULL; i<TCP_MAX_CLIENTS && c == NULL; i++)
+    {
+      c = (srv->client[i].active ? NULL : &(srv->client[i]));
+    }
+
+    if(c == NULL)
+    {
+      printf("Too many TCP clients, refusing %s:%d.\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+      close(fd);
+      continue;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // batching is done by sendmsg
+
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->addr = addr;
+    if(srv->zerocopy)
+    {
+      if(setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+      {
+        c->zerocopy = 1;
+      }
+      else
+      {
+        printf("MSG_ZEROCOPY unavailable, copying frames.\n");
+      }
+    }
+
+    pthread_mutex_lock(&(srv->lock));
+    c->active = 1;
+    srv->client_nr++;
+    pthread_mutex_unlock(&(srv->lock));
+
+    printf("Accepted TCP client %s:%d.\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+    len = sizeof(addr);
+  }
+
+  return;
+}
+
+// release the frames of the zerocopy sends the kernel has completed
+static void reap_zerocopy(TCP_STREAM *srv, TCP_CLIENT *c)
+{
+  uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct sock_extended_err *err;
+
+  for(;;)
+  {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if(recvmsg(c->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+    {
+      break;
+    }
+
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      err = (struct sock_extended_err *) CMSG_DATA(cmsg);
+      if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+      {
+        continue;
+      }
+      if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+      {
+        c->copied += err->ee_data - err->ee_info + 1;
+      }
+
+      // completions cover [ee_info, ee_data] and arrive in order
+      pthread_mutex_lock(&(srv->lock));
+      while(c->zc_head != c->zc_tail && (int32_t) (c->zc[c->zc_head % TCP_ZC_MAX].seq - err->ee_data) <= 0)
+      {
+        frame_put(srv, c->zc[c->zc_head % TCP_ZC_MAX].frame);
+        c->zc_head++;
+      }
+      pthread_mutex_unlock(&(srv->lock));
+    }
+  }
+
+  return;
+}
+
+// Send as many claimed frames as the socket takes with one sendmsg (a
+// writev that can carry MSG_ZEROCOPY); returns 1 when frames are left.
+static int flush_client(TCP_STREAM *srv, TCP_CLIENT *c)
+{
+  struct iovec iov[TCP_IOV];
+  struct msghdr msg;
+  size_t len, left;
+  ssize_t sent;
+  unsigned i, done;
+
+  pthread_mutex_lock(&(srv->lock));
+  while(c->send_nr < TCP_IOV && c->head != c->tail)
+  {
+    c->send[c->send_nr++] = c->queue[c->head++ % TCP_CLIENT_QUEUE];
+  }
+  pthread_mutex_unlock(&(srv->lock));
+
+  if(c->send_nr == 0)
+  {
+    return 0;
+  }
+  if(c->zerocopy && c->zc_tail - c->zc_head > TCP_ZC_MAX - TCP_IOV)
+  {
+    return 1; // wait for completions before pinning more frames
+  }
+
+  for(i=0; i<c->send_nr; i++)
+  {
+    len = TCP_PREFIX_SIZE + ((srv->frame[c->send[i]][0] << 8) | srv->frame[c->send[i]][1]);
+    iov[i].iov_base = srv->frame[c->send[i]] + (i == 0 ? c->send_off : 0);
+    iov[i].iov_len = len - (i == 0 ? c->send_off : 0);
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = c->send_nr;
+
+  if((sent = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | (c->zerocopy ? MSG_ZEROCOPY : 0))) == -1)
+  {
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+    {
+      return 1;
+    }
+    c->closing = 1;
+    return 0;
+  }
+
+  // every frame this call touched stays pinned until its completion
+  pthread_mutex_lock(&(srv->lock));
+  for(i=0, left=(size_t) sent, done=0; i<c->send_nr && left > 0; i++)
+  {
+    if(c->zerocopy)
+    {
+      c->zc[c->zc_tail % TCP_ZC_MAX].seq = c->zc_seq;
+      c->zc[c->zc_tail % TCP_ZC_MAX].frame = c->send[i];
+      c->zc_tail++;
+      srv->ref[c->send[i]]++;
+    }
+    if(left >= iov[i].iov_len)
+    {
+      left -= iov[i].iov_len;
+      frame_put(srv, c->send[i]);
+      c->send_off = 0;
+      done++;
+    }
+    else
+    {
+      c->send_off += left;
+      left = 0;
+    }
+  }
+  pthread_mutex_unlock(&(srv->lock));
+
+  if(c->zerocopy)
+  {
+    c->zc_seq++;
+  }
+
+  memmove(c->send, c->send + done, (c->send_nr - done) * sizeof(c->send[0]));
+  c->send_nr -= done;
+  c->sent += done;
+
+  return (c->send_nr > 0 || c->head != c->tail);
+}
+
+void *tcp_stream_th(void *args)
+{
+  TCP_STREAM *srv = (TCP_STREAM *) args;
+  struct pollfd pfd[TCP_MAX_CLIENTS + 2];
+  TCP_CLIENT *slot[TCP_MAX_CLIENTS + 2];
+  uint8_t discard[256];
+  uint64_t events;
+  int backlog[TCP_MAX_CLIENTS] = {0};
+  int nfds, i, n;
+  ssize_t r;
+
+  while(!srv->stop)
+  {
+    pfd[0].fd = srv->event_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = srv->listen_fd;
+    pfd[1].events = POLLIN;
+    nfds = 2;
+
+    for(i=0; i<TCP_MAX_CLIENTS; i++)
+    {
+      if(srv->client[i].active)
+      {
+        pfd[nfds].fd = srv->client[i].fd;
+        pfd[nfds].events = POLLIN | (backlog[i] ? POLLOUT : 0);
+        slot[nfds] = &(srv->client[i]);
+        nfds++;
+      }
+    }
+
+    if((n = poll(pfd, nfds, 200)) < 0)
+    {
+      continue;
+    }
+
+    if(pfd[0].revents & POLLIN)
+    {
+      r = read(srv->event_fd, &events, sizeof(events));
+      (void) r;
+    }
+    if(pfd[1].revents & POLLIN)
+    {
+      accept_clients(srv);
+    }
+
+    for(i=2; i<nfds; i++)
+    {
+      TCP_CLIENT *c = slot[i];
+
+      if(pfd[i].revents & POLLERR)
+      {
+        reap_zerocopy(srv, c);
+      }
+      if(pfd[i].revents & (POLLIN | POLLHUP))
+      {
+        // clients only listen: anything they send is discarded
+        if((r = recv(c->fd, discard, sizeof(discard), MSG_DONTWAIT)) == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+          c->closing = 1;
+        }
+      }
+
+      if(!c->closing)
+      {
+        backlog[c - srv->client] = flush_client(srv, c);
+      }
+      if(c->closing)
+      {
+        backlog[c - srv->client] = 0;
+        close_client(srv, c);
+      }
+    }
+  }
+
+  return (void *)0;
+}
+
+int tcp_stream_open(TCP_STREAM *srv, uint16_t port, int zerocopy, int policy)
+{
+  struct sockaddr_in addr;
+  int one = 1, i;
+
+  memset(srv, 0, sizeof(*srv));
+  pthread_mutex_init(&(srv->lock), NULL);
+  srv->zerocopy = zerocopy;
+  srv->policy = policy;
+  srv->listen_fd = -1;
+  srv->event_fd = -1;
+
+  for(i=0; i<TCP_POOL_FRAMES; i++)
+  {
+    srv->free_list[i] = (uint16_t) (TCP_POOL_FRAMES - 1 - i);
+  }
+  srv->free_nr = TCP_POOL_FRAMES;
+
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if((srv->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1 ||
+     setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+     bind(srv->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+     listen(srv->listen_fd, TCP_MAX_CLIENTS) == -1 ||
+     (srv->event_fd = eventfd(0, EFD_NONBLOCK)) == -1)
+  {
+    printf("Unable to open TCP stream server on port %d: %s.\n", port, strerror(errno));
+    tcp_stream_close(srv);
+    return -1;
+  }
+
+  if(footprint_thread_create(&(srv->thread), tcp_stream_th, srv) != 0)
+  {
+    printf("Unable to start TCP stream server.\n");
+    tcp_stream_close(srv);
+    return -1;
+  }
+
+  srv->active = 1;
+  printf("Open TCP stream server on port %d (%s, %s).\n", port, zerocopy ? "MSG_ZEROCOPY" : "copy",
+         policy == TCP_POLICY_DISCONNECT ? "disconnect slow clients" : "drop oldest frames");
+
+  return 0;
+}
+
+// free pool frame for a producer, NULL without clients or when the pool is
+// exhausted by slow clients
+uint8_t *tcp_stream_frame(TCP_STREAM *srv, int *frame, size_t *capacity)
+{
+  uint16_t f;
+
+  pthread_mutex_lock(&(srv->lock));
+  if(srv->client_nr == 0 || srv->free_nr == 0)
+  {
+    pthread_mutex_unlock(&(srv->lock));
+    return NULL;
+  }
+  f = srv->free_list[--srv->free_nr];
+  srv->ref[f] = 1;
+  pthread_mutex_unlock(&(srv->lock));
+
+  *frame = f;
+  *capacity = TCP_FRAME_SIZE - TCP_PREFIX_SIZE;
+
+  return srv->frame[f] + TCP_PREFIX_SIZE;
+}
+
+// queue a frame to every client; a full queue loses its oldest frame or
+// gets its client disconnected, the producer never waits
+void tcp_stream_commit(TCP_STREAM *srv, int frame, uint16_t stream, size_t len)
+{
+  uint8_t *prefix = srv->frame[frame];
+  TCP_CLIENT *c;
+  int i;
+
+  prefix[0] = (uint8_t) (len >> 8);
+  prefix[1] = (uint8_t) len;
+  prefix[2] = (uint8_t) (stream >> 8);
+  prefix[3] = (uint8_t) stream;
+
+  pthread_mutex_lock(&(srv->lock));
+  for(i=0; i<TCP_MAX_CLIENTS; i++)
+  {
+    c = &(srv->client[i]);
+    if(!c->active || c->closing)
+    {
+      continue;
+    }
+
+    if(c->tail - c->head >= TCP_CLIENT_QUEUE)
+    {
+      if(srv->policy == TCP_POLICY_DISCONNECT)
+      {
+        c->closing = 1;
+        continue;
+      }
+      frame_put(srv, c->queue[c->head++ % TCP_CLIENT_QUEUE]);
+      c->dropped++;
+    }
+
+    c->queue[c->tail++ % TCP_CLIENT_QUEUE] = (uint16_t) frame;
+    srv->ref[frame]++;
+  }
+  frame_put(srv, (uint16_t) frame); // the producer's reference
+  __atomic_store_n(&(srv->pending), 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&(srv->lock));
+
+  return;
+}
+
+void tcp_stream_drop(TCP_STREAM *srv)
+{
+  __atomic_fetch_add(&(srv->dropped), 1, __ATOMIC_RELAXED);
+
+  return;
+}
+
+// wake the server thread once per batch of commits
+void tcp_stream_kick(TCP_STREAM *srv)
+{
+  uint64_t one = 1;
+  ssize_t r;
+
+  if(__atomic_exchange_n(&(srv->pending), 0, __ATOMIC_ACQ_REL))
+  {
+    r = write(srv->event_fd, &one, sizeof(one));
+    (void) r;
+  }
+
+  return;
+}
+
+void tcp_stream_close(TCP_STREAM *srv)
+{
+  int i;
+
+  if(srv->active)
+  {
+    srv->stop = 1;
+    __atomic_store_n(&(srv->pending), 1, __ATOMIC_RELEASE);
+    tcp_stream_kick(srv);
+    pthread_join(srv->thread, NULL);
+
+    for(i=0; i<TCP_MAX_CLIENTS; i++)
+    {
+      if(srv->client[i].active)
+      {
+        close_client(srv, &(srv->client[i]));
+      }
+    }
+    srv->active = 0;
+  }
+
+  if(srv->listen_fd != -1)
+  {
+    close(srv->listen_fd);
+    srv->listen_fd = -1;
+  }
+  if(srv->event_fd != -1)
+  {
+    close(srv->event_fd);
+    srv->event_fd = -1;
+  }
+
+  return;
+}
@@ -0,0 +1,529 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint64_t pack_user_data(int op, int fd, int frame)
+{
+  return ((uint64_t) op << 48) | ((uint64_t) (uint32_t) fd << 16) | (uint16_t) frame;
+}
+
+static void unmap_ring(URING *ring)
+{
+  if(ring->fd >= 0)
+  {
+    close(ring->fd);
+  }
+  if(ring->sqes && ring->sqes != MAP_FAILED)
+  {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if(ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+  {
+    munmap(ring->cq_ptr, ring->cq_size);
+  }
+  if(ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+  {
+    munmap(ring->sq_ptr, ring->sq_size);
+  }
+  if(ring->frame && (void *) ring->frame != MAP_FAILED)
+  {
+    munmap(ring->frame, (size_t) URING_FRAMES * URING_FRAME_SIZE);
+  }
+
+  ring->fd = -1;
+  ring->sqes = NULL;
+  ring->cq_ptr = NULL;
+  ring->sq_ptr = NULL;
+  ring->frame = NULL;
+
+  return;
+}
+
+// SEND_ZC needs a 6.0 kernel, older ones copy
+static int probe_send_zc(URING *ring)
+{
+  struct io_uring_probe *probe;
+  size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  int supported = 0;
+
+  if((probe = (struct io_uring_probe *) calloc(1, size)) == NULL)
+  {
+    return 0;
+  }
+
+  if(sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 && probe->last_op >= IORING_OP_SEND_ZC)
+  {
+    supported = (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED) != 0;
+  }
+  free(probe);
+
+  return supported;
+}
+
+int uring_open(URING *ring, int sqpoll, int zerocopy)
+{
+  struct io_uring_params p;
+  struct iovec reg[URING_FRAMES];
+  unsigned i;
+
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+
+  memset(&p, 0, sizeof(p));
+  if(sqpoll)
+  {
+    p.flags |= IORING_SETUP_SQPOLL;
+    p.sq_thread_idle = URING_SQ_IDLE_MS;
+  }
+
+  if((ring->fd = sys_io_uring_setup(URING_ENTRIES, &p)) < 0)
+  {
+    printf("Unable to create io_uring: %s.\n", strerror(errno));
+    ring->fd = -1;
+    return -1;
+  }
+
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    ring->sq_size = ring->cq_size = (ring->sq_size > ring->cq_size ? ring->sq_size : ring->cq_size);
+  }
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if(ring->sq_ptr != MAP_FAILED)
+  {
+    ring->cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_ptr :
+      mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  }
+  ring->frame = (uint8_t (*)[URING_FRAME_SIZE]) mmap(NULL, (size_t) URING_FRAMES * URING_FRAME_SIZE, PROT_READ | PROT_WRITE,
+                                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+  if(ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || (void *) ring->sqes == MAP_FAILED || (void *) ring->frame == MAP_FAILED)
+  {
+    printf("Unable to map io_uring: %s.\n", strerror(errno));
+    unmap_ring(ring);
+    return -1;
+  }
+
+  ring->sq_head = (unsigned *) ((uint8_t *) ring->sq_ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned *) ((uint8_t *) ring->sq_ptr + p.sq_off.tail);
+  ring->sq_mask = (unsigned *) ((uint8_t *) ring->sq_ptr + p.sq_off.ring_mask);
+  ring->sq_flags = (unsigned *) ((uint8_t *) ring->sq_ptr + p.sq_off.flags);
+  ring->sq_array = (unsigned *) ((uint8_t *) ring->sq_ptr + p.sq_off.array);
+  ring->sq_entries = p.sq_entries;
+  ring->cq_head = (unsigned *) ((uint8_t *) ring->cq_ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned *) ((uint8_t *) ring->cq_ptr + p.cq_off.tail);
+  ring->cq_mask = (unsigned *) ((uint8_t *) ring->cq_ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((uint8_t *) ring->cq_ptr + p.cq_off.cqes);
+
+  // the pool becomes fixed buffers only for zerocopy sends, registration pins it
+  if(zerocopy)
+  {
+    for(i=0; i<URING_FRAMES; i++)
+    {
+      reg[i].iov_base = ring->frame[i];
+      reg[i].iov_len = URING_FRAME_SIZE;
+    }
+    if(!probe_send_zc(ring))
+    {
+      printf("io_uring has no zerocopy send, frames are copied.\n");
+    }
+    else if(sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, reg, URING_FRAMES) != 0)
+    {
+      printf("Unable to register io_uring buffers: %s, frames are copied.\n", strerror(errno));
+    }
+    else
+    {
+      ring->zerocopy = 1;
+    }
+  }
+
+  for(i=0; i<URING_FRAMES; i++)
+  {
+    ring->free_list[i] = (uint16_t) (URING_FRAMES - 1 - i);
+  }
+  ring->free_nr = URING_FRAMES;
+  ring->sqpoll = sqpoll;
+  ring->ext_arg = (p.features & IORING_FEAT_EXT_ARG) != 0;
+
+  pthread_mutex_init(&(ring->lock), NULL);
+  ring->active = 1;
+
+  printf("Open io_uring with %u entries and %d frames%s%s.\n", ring->sq_entries, URING_FRAMES,
+         ring->zerocopy ? ", zerocopy sends on registered buffers" : "", sqpoll ? ", SQPOLL" : "");
+
+  return 0;
+}
+
+// give back the frames whose sends completed and queue the completed receives
+static void reap(URING *ring)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head = *(ring->cq_head);
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  URING_RECV *rx;
+  int op, frame;
+
+  for(; head != tail; head++)
+  {
+    cqe = &(ring->cqes[head & *(ring->cq_mask)]);
+    op = (int) (cqe->user_data >> 48);
+    frame = (int) (cqe->user_data & 0xffff);
+
+    if(op == URING_OP_SEND)
+    {
+      // a zerocopy send completes twice: the result, flagged MORE, then
+      // the notification that the buffer is free
+      if(!(cqe->flags & IORING_CQE_F_NOTIF))
+      {
+        if(cqe->res < 0)
+        {
+          ring->errors++;
+          if(ring->send_error == 0)
+          {
+            ring->send_error = cqe->res;
+          }
+        }
+        else
+        {
+          ring->sent++;
+        }
+      }
+      if(!(cqe->flags & IORING_CQE_F_MORE))
+      {
+        ring->free_list[ring->free_nr++] = (uint16_t) frame;
+      }
+    }
+    else if(op == URING_OP_RECV)
+    {
+      rx = &(ring->recv[ring->recv_tail++ % URING_FRAMES]);
+      rx->fd = (int) ((cqe->user_data >> 16) & 0xffffffff);
+      rx->res = cqe->res;
+      rx->frame = (uint16_t) frame;
+    }
+  }
+
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+  return;
+}
+
+// Hand the queued entries to the kernel and optionally wait for
+// completions. Under SQPOLL the kernel thread takes the entries by itself:
+// the call only happens to wake it up or to wait.
+static int submit(URING *ring, unsigned min_complete, int timeout_ms)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned flags = 0, to_submit = ring->to_submit;
+  int ret;
+
+  if(ring->sqpoll)
+  {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // tail store before the flags load
+    if(__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+    {
+      flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+    to_submit = 0;
+    ring->to_submit = 0;
+  }
+
+  if(min_complete > 0)
+  {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  if(to_submit == 0 && flags == 0)
+  {
+    return 0;
+  }
+
+  if(min_complete > 0 && timeout_ms >= 0)
+  {
+    if(!ring->ext_arg)
+    {
+      return -EOPNOTSUPP;
+    }
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long) (timeout_ms % 1000) * 1000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+    ret = sys_io_uring_enter(ring->fd, to_submit, min_complete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  }
+  else
+  {
+    ret = sys_io_uring_enter(ring->fd, to_submit, min_complete, flags, NULL, 0);
+  }
+  ring->enters++;
+
+  if(ret < 0)
+  {
+    return -errno;
+  }
+  if(!ring->sqpoll)
+  {
+    ring->to_submit -= (unsigned) ret;
+  }
+
+  return 0;
+}
+
+static struct io_uring_sqe *next_sqe(URING *ring)
+{
+  struct io_uring_sqe *sqe;
+  unsigned tail = *(ring->sq_tail), index;
+
+  if(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+  {
+    return NULL;
+  }
+
+  index = tail & *(ring->sq_mask);
+  ring->sq_array[index] = index;
+  sqe = &(ring->sqes[index]);
+  memset(sqe, 0, sizeof(*sqe));
+
+  return sqe;
+}
+
+static void push_sqe(URING *ring)
+{
+  __atomic_store_n(ring->sq_tail, *(ring->sq_tail) + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+
+  return;
+}
+
+// a free frame of the pool, waiting for a completion when all are in flight
+uint8_t *uring_frame(URING *ring, int *frame, size_t *capacity)
+{
+  uint8_t *data = NULL;
+
+  pthread_mutex_lock(&(ring->lock));
+  reap(ring);
+  while(ring->free_nr == 0 && submit(ring, 1, -1) == 0)
+  {
+    reap(ring);
+  }
+  if(ring->free_nr > 0)
+  {
+    *frame = ring->free_list[--ring->free_nr];
+    *capacity = URING_FRAME_SIZE;
+    data = ring->frame[*frame];
+  }
+  pthread_mutex_unlock(&(ring->lock));
+
+  return data;
+}
+
+// queue a datagram built in a pool frame, submitted by the next kick
+void uring_send(URING *ring, int frame, int fd, size_t len, const struct sockaddr_in *dest)
+{
+  struct io_uring_sqe *sqe;
+  int error_code = 0;
+
+  pthread_mutex_lock(&(ring->lock));
+  while((sqe = next_sqe(ring)) == NULL && (error_code = submit(ring, 0, -1)) == 0)
+  {
+    sched_yield(); // SQPOLL thread behind
+  }
+
+  if(sqe == NULL)
+  {
+    ring->errors++;
+    if(ring->send_error == 0)
+    {
+      ring->send_error = error_code;
+    }
+    ring->free_list[ring->free_nr++] = (uint16_t) frame;
+    pthread_mutex_unlock(&(ring->lock));
+    return;
+  }
+
+  ring->addr[frame] = *dest;
+
+  sqe->fd = fd;
+  if(ring->zerocopy) // SEND_ZC takes the destination since its first kernel
+  {
+    sqe->opcode = IORING_OP_SEND_ZC;
+    sqe->addr = (uint64_t) (uintptr_t) ring->frame[frame];
+    sqe->len = (uint32_t) len;
+    sqe->addr2 = (uint64_t) (uintptr_t) &(ring->addr[frame]);
+    sqe->addr_len = (uint16_t) sizeof(struct sockaddr_in);
+    sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+    sqe->buf_index = (uint16_t) frame;
+  }
+  else // SEND only takes it from 6.0, SENDMSG since 5.3
+  {
+    ring->iov[frame].iov_base = ring->frame[frame];
+    ring->iov[frame].iov_len = len;
+    memset(&(ring->msg[frame]), 0, sizeof(struct msghdr));
+    ring->msg[frame].msg_name = &(ring->addr[frame]);
+    ring->msg[frame].msg_namelen = sizeof(struct sockaddr_in);
+    ring->msg[frame].msg_iov = &(ring->iov[frame]);
+    ring->msg[frame].msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uint64_t) (uintptr_t) &(ring->msg[frame]);
+    sqe->len = 1;
+  }
+  sqe->user_data = pack_user_data(URING_OP_SEND, fd, frame);
+  push_sqe(ring);
+
+  pthread_mutex_unlock(&(ring->lock));
+
+  return;
+}
+
+// One system call for the whole batch, none under SQPOLL while its thread
+// is awake. A send that completed with an error since the last kick fails
+// the kick as well, e.g. a kernel rejecting the operation.
+int uring_kick(URING *ring)
+{
+  int error_code, send_error;
+
+  pthread_mutex_lock(&(ring->lock));
+  error_code = submit(ring, 0, -1);
+  reap(ring);
+  send_error = ring->send_error;
+  ring->send_error = 0;
+  pthread_mutex_unlock(&(ring->lock));
+
+  if(error_code != 0)
+  {
+    printf("io_uring submission failed: %s.\n", strerror(-error_code));
+  }
+  else if(send_error != 0)
+  {
+    printf("io_uring send failed: %s.\n", strerror(-send_error));
+    error_code = send_error;
+  }
+
+  return error_code;
+}
+
+// post a receive on fd into a pool frame, submitted by the next wait
+int uring_recv(URING *ring, int fd)
+{
+  struct io_uring_sqe *sqe;
+  int frame, error_code = -1;
+
+  pthread_mutex_lock(&(ring->lock));
+  reap(ring);
+  if(ring->free_nr > 0 && (sqe = next_sqe(ring)) != NULL)
+  {
+    frame = ring->free_list[--ring->free_nr];
+
+    ring->iov[frame].iov_base = ring->frame[frame];
+    ring->iov[frame].iov_len = URING_FRAME_SIZE;
+    memset(&(ring->msg[frame]), 0, sizeof(struct msghdr));
+    ring->msg[frame].msg_name = &(ring->addr[frame]);
+    ring->msg[frame].msg_namelen = sizeof(struct sockaddr_in);
+    ring->msg[frame].msg_iov = &(ring->iov[frame]);
+    ring->msg[frame].msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) &(ring->msg[frame]);
+    sqe->len = 1;
+    sqe->user_data = pack_user_data(URING_OP_RECV, fd, frame);
+    push_sqe(ring);
+    error_code = 0;
+  }
+  pthread_mutex_unlock(&(ring->lock));
+
+  return error_code;
+}
+
+// Next completed receive: its length (or -errno) with the socket, the
+// frame holding the datagram and the sender. Returns -ETIME after
+// timeout_ms, -EINTR on a signal and another -errno when the ring fails,
+// with *frame set to -1. The frame goes back with uring_release.
+int uring_wait_recv(URING *ring, int timeout_ms, int *fd, int *frame, struct sockaddr_in *src)
+{
+  URING_RECV *rx;
+  int res = 0;
+
+  *frame = -1;
+
+  pthread_mutex_lock(&(ring->lock));
+  reap(ring);
+  if(ring->recv_head == ring->recv_tail)
+  {
+    res = submit(ring, 1, timeout_ms);
+    reap(ring);
+  }
+  if(ring->recv_head != ring->recv_tail)
+  {
+    rx = &(ring->recv[ring->recv_head++ % URING_FRAMES]);
+    *fd = rx->fd;
+    *frame = rx->frame;
+    *src = ring->addr[rx->frame];
+    res = rx->res;
+  }
+  else if(res == 0)
+  {
+    res = -ETIME;
+  }
+  pthread_mutex_unlock(&(ring->lock));
+
+  return res;
+}
+
+void uring_release(URING *ring, int frame)
+{
+  pthread_mutex_lock(&(ring->lock));
+  ring->free_list[ring->free_nr++] = (uint16_t) frame;
+  pthread_mutex_unlock(&(ring->lock));
+
+  return;
+}
+
+void uring_close(URING *ring)
+{
+  if(!ring->active)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&(ring->lock));
+  printf("Closing io_uring: %lu datagrams sent, %lu errors, %lu system calls.\n", ring->sent, ring->errors, ring->enters);
+  ring->active = 0;
+  unmap_ring(ring);
+  pthread_mutex_unlock(&(ring->lock));
+  pthread_mutex_destroy(&(ring->lock));
+
+  return;
+}
@@ -0,0 +1,209 @@
+/*******************************************************************************
+* included libraries
+*******************************************************************************/
+#include "../include/worker_pool.h"
+#include "../include/footprint.h"
+
+#include <stdio.h>
+
+/*******************************************************************************
+* custom functions
+*******************************************************************************/
+static int pop_task(POOL_QUEUE *q, size_t *task)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&(q->lock));
+  if(q->begin < q->end)
+  {
+    *task = q->begin++;
+    found = 1;
+  }
+  pthread_mutex_unlock(&(q->lock));
+
+  return found;
+}
+
+// take the last task of the first busy worker; thieves never write their
+// own queue, so a late thief cannot clobber the ranges of the next run
+static int steal_task(WORKER_POOL *pool, int id, size_t *task)
+{
+  POOL_QUEUE *victim;
+  int i, found = 0;
+
+  for(i=1; i<pool->workers && !found; i++)
+  {
+    victim = &(pool->queue[(id + i) % pool->workers]);
+
+    pthread_mutex_lock(&(victim->lock));
+    if(victim->begin < victim->end)
+    {
+      *task = --victim->end;
+      found = 1;
+    }
+    pthread_mutex_unlock(&(victim->lock));
+  }
+
+  return found;
+}
+
+static void work(WORKER_POOL *pool, int id)
+{
+  size_t task;
+
+  while(pop_task(&(pool->queue[id]), &task) || steal_task(pool, id, &task))
+  {
+    // fn/arg are published before the queues are filled, the queue lock
+    // taken by pop/steal orders the two reads
+    pool->fn(pool->arg, task);
+
+    if(__atomic_sub_fetch(&(pool->pending), 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      pthread_mutex_lock(&(pool->lock));
+      pthread_cond_broadcast(&(pool->done_cv));
+      pthread_mutex_unlock(&(pool->lock));
+    }
+  }
+
+  return;
+}
+
+static void *worker_th(void *args)
+{
+  POOL_WORKER *wa = (POOL_WORKER *) args;
+  WORKER_POOL *pool = wa->pool;
+  uint64_t seen = 0;
+
+  while(1)
+  {
+    pthread_mutex_lock(&(pool->lock));
+    while(!pool->stop && pool->generation == seen)
+    {
+      pthread_cond_wait(&(pool->start_cv), &(pool->lock));
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&(pool->lock));
+
+    if(pool->stop)
+    {
+      break;
+    }
+
+    work(pool, wa->id);
+  }
+
+  return (void *)0;
+}
+
+int worker_pool_init(WORKER_POOL *pool, int workers)
+{
+  int i;
+
+  if(workers < 1 || workers > WORKER_POOL_MAX)
+  {
+    printf("Invalid number of workers: %d.\n", workers);
+    return -1;
+  }
+
+  pool->workers = workers;
+  pool->generation = 0;
+  pool->stop = 0;
+  pool->fn = NULL;
+  pool->arg = NULL;
+  pool->pending = 0;
+
+  pthread_mutex_init(&(pool->lock), NULL);
+  pthread_cond_init(&(pool->start_cv), NULL);
+  pthread_cond_init(&(pool->done_cv), NULL);
+
+  for(i=0; i<workers; i++)
+  {
+    pthread_mutex_init(&(pool->queue[i].lock), NULL);
+    pool->queue[i].begin = 0;
+    pool->queue[i].end = 0;
+  }
+
+  // worker 0 is the thread calling worker_pool_run()
+  for(i=1; i<workers; i++)
+  {
+    pool->worker[i].pool = pool;
+    pool->worker[i].id = i;
+    if(footprint_thread_create(&(pool->tid[i]), worker_th, &(pool->worker[i])) != 0)
+    {
+      printf("Unable to start pool worker %d.\n", i);
+      pool->workers = i;
+      worker_pool_destroy(pool);
+      return -1;
+    }
+  }
+
+  printf("Worker pool started with %d workers.\n", workers);
+
+  return 0;
+}
+
+void worker_pool_run(WORKER_POOL *pool, POOL_TASK_FN fn, void *arg, size_t tasks)
+{
+  size_t share, begin = 0;
+  int i;
+
+  if(tasks == 0)
+  {
+    return;
+  }
+
+  pool->fn = fn;
+  pool->arg = arg;
+  __atomic_store_n(&(pool->pending), tasks, __ATOMIC_RELEASE);
+
+  share = tasks / pool->workers;
+  for(i=0; i<pool->workers; i++)
+  {
+    pthread_mutex_lock(&(pool->queue[i].lock));
+    pool->queue[i].begin = begin;
+    begin += share + ((size_t) i < tasks % pool->workers ? 1 : 0);
+    pool->queue[i].end = begin;
+    pthread_mutex_unlock(&(pool->queue[i].lock));
+  }
+
+  pthread_mutex_lock(&(pool->lock));
+  pool->generation++;
+  pthread_cond_broadcast(&(pool->start_cv));
+  pthread_mutex_unlock(&(pool->lock));
+
+  work(pool, 0);
+
+  pthread_mutex_lock(&(pool->lock));
+  while(__atomic_load_n(&(pool->pending), __ATOMIC_ACQUIRE) > 0)
+  {
+    pthread_cond_wait(&(pool->done_cv), &(pool->lock));
+  }
+  pthread_mutex_unlock(&(pool->lock));
+
+  return;
+}
+
+void worker_pool_destroy(WORKER_POOL *pool)
+{
+  int i;
+
+  pthread_mutex_lock(&(pool->lock));
+  pool->stop = 1;
+  pthread_cond_broadcast(&(pool->start_cv));
+  pthread_mutex_unlock(&(pool->lock));
+
+  for(i=1; i<pool->workers; i++)
+  {
+    pthread_join(pool->tid[i], NULL);
+  }
+
+  for(i=0; i<pool->workers; i++)
+  {
+    pthread_mutex_destroy(&(pool->queue[i].lock));
+  }
+  pthread_cond_destroy(&(pool->done_cv));
+  pthread_cond_destroy(&(pool->start_cv));
+  pthread_mutex_destroy(&(pool->lock));
+
+  return;
+}